@@ -7,6 +7,7 @@
 #include <getopt.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -14,15 +15,126 @@
 #include <errno.h>
 #include <math.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <stdint.h>
+#include <libgen.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <regex.h>
 
+#include <zlib.h>
 #include <curl/curl.h>
 
+#define STAT_SET(v, n) __atomic_store_n(&(v), (n), __ATOMIC_RELAXED)
+#define STAT_ADD(v, n) STAT_SET(v, (v) + (n))
+#define STAT_GET(v) __atomic_load_n(&(v), __ATOMIC_RELAXED)
+
+// where response bodies go
+enum {
+    BODY_DEFAULT = 0,
+    BODY_DISCARD,
+    BODY_STDERR,
+    BODY_CHECKSUM,
+    BODY_SAMPLE,
+};
+static const char *body_names[] = {"", "discard", "stderr", "checksum", "sample"};
+
+#define BODY_BUFSIZE (64 * 1024)
+
+// --corpus: a request of the memory-mapped corpus, all pointers go into the mapping
+typedef struct {
+    double time; // original send time, 0 when the corpus has none
+    char *method, *url;
+    struct curl_slist *headers;
+    char *body;
+    long int body_len;
+} corpus_entry_t;
+
+// -T and -F @file contents are mapped once, every handle reads them through its own cursor
+typedef struct {
+    const char *data;
+    size_t size, pos;
+} mem_cursor_t;
+
+// templates: {{seq}}, {{rand:<min>-<max>}}, {{uuid}}, {{line:<file>}} and {{idx}} in <url>s, -H and -d
+enum {
+    TMPL_TEXT = 0,
+    TMPL_SEQ,
+    TMPL_RAND,
+    TMPL_UUID,
+    TMPL_LINE,
+    TMPL_IDX,
+};
+
+typedef struct {
+    char *path;
+    char *map;
+    size_t size;
+    struct {
+        const char *ptr;
+        int len;
+    } *lines;
+    long int linec;
+    int max_len;
+} tmpl_file_t;
+
+typedef struct {
+    int type;
+    const char *text; // TMPL_TEXT
+    int len;
+    long int min, max; // TMPL_RAND
+    tmpl_file_t *file; // TMPL_LINE
+} tmpl_part_t;
+
+typedef struct {
+    int partc;
+    tmpl_part_t *parts;
+    size_t size; // of the longest rendering, with the '\0'
+} tmpl_t;
+
+// --expect: a request fails when any of them does not hold
+enum {
+    EXPECT_STATUS = 0,
+    EXPECT_HEADER,
+    EXPECT_BODY,
+    EXPECT_REGEX,
+    EXPECT_SIZE,
+    EXPECT_JSON,
+};
+
+#define EXPECT_MAX 8
+#define EXPECT_NEEDLE 256 // longest body= substring, its carry over chunks is one byte less
+
+typedef struct {
+    int type;
+    char *arg; // as given, for the reports
+    long int min, max; // EXPECT_STATUS and EXPECT_SIZE
+    char *name, *value; // header name and value substring, body substring, json path and value
+    size_t name_len, value_len;
+    regex_t re;
+} expect_t;
+
+// format of the interval and summary reports
+enum {
+    OUTPUT_TEXT = 0,
+    OUTPUT_JSON,
+    OUTPUT_CSV,
+};
+
 typedef struct {
     bool isatty_stdout;
     bool isatty_stderr;
 
     bool info;
     char *debug;
+    int trace_fd;
 
     bool verbose;
     int headerc;
@@ -36,57 +148,364 @@ typedef struct {
         bool is_file;
         char *name;
         char *value;
+        char *map;
+        size_t size;
     } forms[128];
     char *cookie;
     char *cookie_file;
     bool cookie_session;
     bool append;
     char *upload_file;
+    char *upload_map;
+    size_t upload_size;
 
     int keepalive;
+    bool no_reuse;
+    int requests_per_conn;
+    bool share;
+    bool insecure;
+    long http_version;
+    bool phases;
+    int body;
+    int sample_every;
+    char *sample_file;
+    unsigned long int *checksums;
+    int max_host_connections;
+    int max_streams;
+    bool epoll;
+    int output;
+    double interval; // seconds between reports
+    char *request_log;
+    int request_log_fd;
     int timeout;
     int connect_timeout;
 
+    int expectc;
+    expect_t expects[EXPECT_MAX];
+    bool expect_header, expect_buffer; // header= needs the header callback, regex= and json= the start of the body
+    curl_write_callback sink; // of --body, called after the checks
+
     int urlc, *urlw;
     char **urls;
+    char *url_file;
+    char *url_buf;
+
+    // --random: alias table over the weights, --seed < 0 seeds from the clock
+    bool random;
+    long int seed;
+    double *alias_prob;
+    int *alias;
+    bool url_stats;
+
+    char *corpus_file;
+    char *corpus_map;
+    size_t corpus_size;
+    corpus_entry_t *corpus;
+    long int corpusc;
+    struct curl_slist *corpus_headers;
+    double replay_speed;
+
+    // templates, NULL where there is no placeholder, are rendered into tmpl_size bytes of every idx: URL, -d, then -H
+    bool templated, header_templated;
+    tmpl_t **url_tmpls;
+    tmpl_t *data_tmpl;
+    tmpl_t *header_tmpls[128];
+    size_t tmpl_size, data_off, header_offs[128];
+
+    CURL *tmpl;
+    struct curl_slist *header_list;
+    CURLSH *sh;
+    bool tls;
 
     int requests;
     int timelimit;
     int concurrency;
+    int threads;
+    double warmup; // seconds
+    int warmup_requests;
+    bool preconnect;
+
+    double rate;
+    bool poisson;
+
+    // --profile: concurrency goes linearly from -> to within each stage
+    int stagec;
+    struct {
+        int from, to;
+        double seconds;
+    } stages[64];
+
+    // --find-capacity: latency limits in microseconds, error ratio (< 0 is no limit), seconds per level
+    bool capacity;
+    int sloc;
+    struct {
+        int stat;
+        long int max;
+    } slos[8];
+    double slo_err;
+    double hold;
+
+    // --self-test: response body size, delay before responding in seconds, responses per connection (0 is no limit)
+    bool self_test;
+    struct {
+        long int size;
+        double delay;
+        int close;
+    } server;
+
+    // --saturation: CPU share of the usable cores and p99 loop lag in microseconds above which latencies are suspect
+    double sat_cpu;
+    long int sat_lag;
+
+    // --coordinator merges the stats of --agents agents, which run the load with their share of -n, -c and --rate
+    char *coordinator;
+    int agents;
+    char *agent;
+    int agent_fd;
 } config_t;
 
+typedef struct worker_s worker_t;
+
 typedef struct {
+    worker_t *worker;
+    int id;
     int i, w;
     int reqs;
-    char *logfile;
     FILE *logfp;
-    double time;
+    long int time; // nanotime() the request started, or was due to with --rate
+
+    mem_cursor_t upload;
+    mem_cursor_t *forms;
+    curl_mime *mime;
+    char *tmpl_buf;
+    struct curl_slist *headers; // with the rendered -H templates
+
+    bool tls_conn, tls_resumed;
+    bool stream;
+    curl_socket_t sock; // the last socket this handle opened
+    bool warmup;
+    int url;
+    long int entry;
+    bool sample;
+    char *sample_buf; // separator and body of a sampled response, written whole when it is done
+    size_t sample_len, sample_size;
+    uLong crc;
+
+    // --expect state of the current request
+    bool expect_met[EXPECT_MAX];
+    unsigned short expect_carry_len[EXPECT_MAX];
+    char *expect_carry; // EXPECT_NEEDLE - 1 bytes for each expectation
+    char *expect_body; // start of the body for regex= and json=, BODY_BUFSIZE + 1 bytes
+    size_t expect_body_len, expect_size;
 
-    struct curl_slist *headers;
-    struct curl_httppost *form;
-    FILE *fp_upload;
-    
-    bool keepalive;
     CURL *curl;
 } idx_t;
 
-char *nowtime(void) {
-	static char buf[64];
-	struct timeval tv = {0, 0};
+// HDR-style histogram of latencies in microseconds: 2^(HIST_SUB_BITS-1) linear sub-buckets per power of 2,
+// so any recorded value is off by less than 1/64 from its bucket, and values up to 2^HIST_MAX_BITS us fit
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 36
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 2) * (HIST_SUB_COUNT / 2))
+
+typedef struct {
+    long int count, sum, min, max;
+    long int counts[HIST_BUCKETS];
+} hist_t;
+
+enum {
+    HIST_MIN = 0,
+    HIST_AVG,
+    HIST_P50,
+    HIST_P90,
+    HIST_P99,
+    HIST_P999,
+    HIST_MAX,
+    HIST_STATS,
+};
+static const char *stat_names[HIST_STATS] = {"min", "avg", "p50", "p90", "p99", "p999", "max"};
+
+// phases of a transfer from CURLINFO_*_TIME_T
+enum {
+    PHASE_DNS = 0,
+    PHASE_CONNECT,
+    PHASE_TLS,
+    PHASE_TTFB,
+    PHASE_TRANSFER,
+    PHASES,
+};
+static const char *phase_names[PHASES] = {"dns", "connect", "tls", "ttfb", "transfer"};
+
+typedef struct {
+    int concurrency, target;
+    int keepalives; // open connections that carried a request
+    long int code0xx, code1xx, code2xx, code3xx, code4xx, code5xx, codex;
+    long int end_reqs;
+    long int req_bytes, res_bytes, bug_bytes;
+    long int late, dropped;
+    long int handshakes, resumed;
+    long int mismatches;
+    long int failures, expect_fails[EXPECT_MAX];
+    int connections; // open sockets
+    int streams; // --http2: transfers attached to an h2 connection
+    long int new_conns, reused_conns; // requests on a new or a reused connection
+    long int loops; // event loop iterations
+    hist_t latency;
+    hist_t phases[PHASES];
+    hist_t loop_lag; // from wakeup to the next wait, the time events that arrived meanwhile wait
+    hist_t conn_reqs, conn_life; // requests and microseconds of the closed connections
+} stats_t;
+
+// --url-stats: counters of one URL in one worker, read only after the workers are done
+typedef struct {
+    long int reqs, req_bytes, res_bytes, failures;
+    long int codes[7]; // 0xx to 5xx, then xxx
+    hist_t latency;
+} url_stats_t;
+
+// -D: debug events of a worker go through a single-producer ring to the trace thread
+#define TRACE_MAGIC "CMTRACE1"
+#define TRACE_RING_SIZE (4 * 1024 * 1024)
+
+enum {
+    TRACE_BEGIN = CURLINFO_END + 1,
+    TRACE_END,
+};
+
+typedef struct {
+    char magic[8];
+    int64_t realtime, monotonic; // nanoseconds at the same moment, to turn event times into wall clock
+    int32_t concurrency;
+    int32_t pad;
+} trace_header_t;
+
+typedef struct {
+    uint64_t ns; // CLOCK_MONOTONIC
+    uint32_t idx;
+    uint32_t reqs;
+    uint16_t type;
+    uint16_t pad;
+    uint32_t len; // followed by len bytes of data, padded to 8 bytes
+} trace_event_t;
+
+typedef struct {
+    char *buf;
+    unsigned long int head, tail; // head is moved by the worker, tail by the trace thread
+    long int dropped;
+} trace_ring_t;
+
+// --request-log: one fixed-size record per finished request, --decode turns the file into CSV
+#define REQUEST_LOG_MAGIC "CMREQS01"
+
+typedef struct {
+    int64_t time; // request start, microseconds since the epoch
+    int64_t req_bytes, res_bytes;
+    uint32_t latency; // microseconds
+    uint32_t phases[PHASES];
+    uint32_t idx, reqs, url;
+    int32_t code;
+} request_record_t;
+
+// connections of a worker by socket fd, a reused one is found by its local port and peer, as local ports repeat across hosts
+#define CONN_PORTS 65536
+
+typedef struct {
+    long int opened; // nanotime()
+    long int reqs; // 0 once closed
+    int port, peer_port;
+    int next; // fd of the next connection on the same local port, -1 ends
+    char peer[INET6_ADDRSTRLEN];
+} conn_t;
+
+// open-loop: an arrival is an intended send time, with its entry when replaying a corpus
+typedef struct {
+    double time;
+    long int entry;
+} arrival_t;
+
+struct worker_s {
+    int id;
+    pthread_t tid;
+    const config_t *cfg;
+    CURLM *multi;
+    CURL *tmpl;
+    idx_t *idxs;
+    int idxc;
+    stats_t stats;
+    stats_t warmup; // results of the warmup requests
+    bool preconnecting;
+
+    // open-loop: arrivals wait in backlog for an idle idx
+    bool scheduling;
+    double rate, next_time;
+    unsigned short seed[3];
+    idx_t **idle;
+    int idlec;
+    arrival_t *backlog;
+    int backlogi, backlogc;
+    long int replay_entry;
+
+    // --profile: idle idxs are added up to target, surplus ones go back to idle when they finish
+    bool profiling;
+    int target;
+
+    // --url-stats: indexed by URL, allocated at the first request of each
+    url_stats_t **url_stats;
+
+    // buffered body output of the stderr and sample sinks
+    int body_fd;
+    char *body_buf;
+    size_t body_len;
+    long int samples;
+
+    trace_ring_t trace;
+
+    // --request-log records, flushed with one write() per buffer
+    char *request_buf;
+    size_t request_len;
+
+    // --epoll: sockets libcurl asked for, the timer it set, and an eventfd for wakeups
+    int epfd, wakefd;
+    double timer;
+
+    conn_t *conns; // indexed by fd, grown as sockets open
+    int connc;
+    int *port_conns; // CONN_PORTS heads of the fd lists by local port
+};
+
+char *fmttime(time_t sec, long int usec, char *buf, size_t size) {
 	struct tm tm;
 
-	gettimeofday(&tv, NULL);
-	localtime_r(&tv.tv_sec, &tm);
+	localtime_r(&sec, &tm);
 
-	snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%06ld",
-		tm.tm_year + 1900, tm.tm_mon, tm.tm_mday,
+	snprintf(buf, size, "%04d-%02d-%02d %02d:%02d:%02d.%06ld",
+		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
 		tm.tm_hour, tm.tm_min, tm.tm_sec,
-		tv.tv_usec
+		usec
 	);
 
 	return buf;
 }
 
+char *nowtime(void) {
+	static __thread char buf[64];
+	struct timeval tv = {0, 0};
+
+	gettimeofday(&tv, NULL);
+
+	return fmttime(tv.tv_sec, tv.tv_usec, buf, sizeof(buf));
+}
+
+static long int wall_offset = 0; // CLOCK_REALTIME - CLOCK_MONOTONIC in nanoseconds, at the start
+
+long int nanotime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
 char *fsize(long int size, char *buf) {
     const char *units = "0KMGTPEZY";
     int unit;
@@ -105,366 +524,3702 @@ char *fsize(long int size, char *buf) {
     return buf;
 }
 
+// seconds on CLOCK_MONOTONIC, for schedules and timeouts, latencies are measured with nanotime()
 double microtime() {
-    struct timeval tv = {0, 0};
+    return nanotime() / 1000000000.0;
+}
 
-    if(gettimeofday(&tv, NULL)) tv.tv_sec = time(NULL);
+// seconds since the epoch, only for timestamps in the reports
+double walltime() {
+    struct timespec ts;
 
-    return (double) tv.tv_sec + tv.tv_usec / 1000000.0f;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
 }
 
-static long int req_bytes = 0, res_bytes = 0, bug_bytes = 0;
-int debug_bytes_handler(CURL *handle, curl_infotype type, char *data, size_t size, void *userp) {
-    switch (type) {
-		case CURLINFO_HEADER_OUT:
-		case CURLINFO_DATA_OUT:
-			res_bytes += size;
-			break;
-		case CURLINFO_HEADER_IN:
-		case CURLINFO_DATA_IN:
-			req_bytes += size;
-			break;
-		case CURLINFO_TEXT:
-			bug_bytes += size;
-			break;
-	}
+// "100ms", "1.5s", "2m" or "500us", seconds without a unit, returns -1 if invalid
+double parse_seconds(const char *arg) {
+    char *end;
+    double v = strtod(arg, &end);
 
-    return 0;
+    if(end == arg || v < 0) return -1;
+    if(!strcmp(end, "us")) return v / 1000000;
+    if(!strcmp(end, "ms")) return v / 1000;
+    if(!strcmp(end, "m")) return v * 60;
+    if(!*end || !strcmp(end, "s")) return v;
+
+    return -1;
 }
 
-int debug_handler(CURL *handle, curl_infotype type, char *data, size_t size, void *userp) {
-    idx_t *idx = (idx_t*) userp;
-    int ret = 0;
+static inline int hist_index(long int v) {
+    int e;
+
+    if(v < HIST_SUB_COUNT) return v < 0 ? 0 : v;
+    if(v >> HIST_MAX_BITS) return HIST_BUCKETS - 1;
+
+    e = 63 - __builtin_clzl(v) - (HIST_SUB_BITS - 1);
+    return e * (HIST_SUB_COUNT / 2) + (v >> e);
+}
+
+long int hist_lowest(int i) {
+    int e;
 
-    debug_bytes_handler(handle, type, data, size, userp);
+    if(i < HIST_SUB_COUNT) return i;
 
-    if(!idx->logfp) return 0;
+    e = i / (HIST_SUB_COUNT / 2) - 1;
+    return (long int) (i % (HIST_SUB_COUNT / 2) + HIST_SUB_COUNT / 2) << e;
+}
+
+long int hist_highest(int i) {
+    return i + 1 < HIST_BUCKETS ? hist_lowest(i + 1) - 1 : hist_lowest(i);
+}
+
+// only the owner thread records, readers merge a snapshot with relaxed loads
+void hist_record(hist_t *h, long int v) {
+    STAT_ADD(h->counts[hist_index(v)], 1);
+    STAT_ADD(h->count, 1);
+    STAT_ADD(h->sum, v);
+    if(v < h->min || h->count == 1) STAT_SET(h->min, v);
+    if(v > h->max) STAT_SET(h->max, v);
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+    long int n, count = 0, min, max;
+    int i;
+
+    for(i=0; i<HIST_BUCKETS; i++) {
+        n = STAT_GET(src->counts[i]);
+        dst->counts[i] += n;
+        count += n;
+    }
+    if(!count) return;
+
+    min = STAT_GET(src->min);
+    max = STAT_GET(src->max);
+    if(!dst->count || min < dst->min) dst->min = min;
+    if(max > dst->max) dst->max = max;
+    dst->count += count;
+    dst->sum += STAT_GET(src->sum);
+}
+
+// dst = cur - prev, min and max are taken from the buckets
+void hist_delta(hist_t *dst, const hist_t *cur, const hist_t *prev) {
+    int i, first = -1, last = -1;
+
+    memset(dst, 0, sizeof(*dst));
+    for(i=0; i<HIST_BUCKETS; i++) {
+        dst->counts[i] = cur->counts[i] - prev->counts[i];
+        if(dst->counts[i]) {
+            if(first < 0) first = i;
+            last = i;
+        }
+    }
+    dst->count = cur->count - prev->count;
+    dst->sum = cur->sum - prev->sum;
+    if(first >= 0) {
+        dst->min = hist_lowest(first);
+        if(dst->min < cur->min) dst->min = cur->min;
+        dst->max = hist_highest(last);
+        if(dst->max > cur->max) dst->max = cur->max;
+    }
+}
+
+void hist_stats(const hist_t *h, long int vals[HIST_STATS]) {
+    static const struct {
+        int stat;
+        double q;
+    } qs[] = {{HIST_P50, 0.5}, {HIST_P90, 0.9}, {HIST_P99, 0.99}, {HIST_P999, 0.999}};
+    long int n = 0, target;
+    int i, j = 0;
+
+    memset(vals, 0, sizeof(long int) * HIST_STATS);
+    if(h->count <= 0) return;
+
+    vals[HIST_MIN] = h->min;
+    vals[HIST_AVG] = h->sum / h->count;
+    vals[HIST_MAX] = h->max;
+
+    target = (long int) ceil(qs[j].q * h->count);
+    for(i=0; i<HIST_BUCKETS && j<sizeof(qs)/sizeof(qs[0]); i++) {
+        n += h->counts[i];
+        while(n >= target && j<sizeof(qs)/sizeof(qs[0])) {
+            vals[qs[j].stat] = hist_highest(i);
+            if(vals[qs[j].stat] > h->max) vals[qs[j].stat] = h->max;
+            if(++j < sizeof(qs)/sizeof(qs[0])) target = (long int) ceil(qs[j].q * h->count);
+        }
+    }
+}
+
+// the text format of -v and of decoded -D traces
+void debug_print(FILE *fp, const char *time, int type, const char *data, size_t size, int reqs) {
+    const char *ptr, *end = data + size;
 
 	switch (type) {
 		case CURLINFO_HEADER_OUT:
-			do {
-				char *ptr;
-				while(size) {
-					ptr = data;
-					
-					if(*ptr) {
-						while(*ptr != '\r' && *ptr != '\n') {
-							ptr ++;
-							size --;
-						}
-						
-						if(*ptr == '\r' && *(ptr+1) == '\n') {
-							ptr +=2 ;
-							size -=2;
-						}
-					}
-					
-					fprintf(idx->logfp, "%s > ", nowtime());
-                    fwrite(data, 1, ptr-data, idx->logfp);
-					data = ptr;
-				}
-			} while(0);
+			while(data < end) {
+				ptr = memchr(data, '\n', end - data);
+				ptr = (ptr ? ptr + 1 : end);
+
+				fprintf(fp, "%s > ", time);
+				fwrite(data, 1, ptr - data, fp);
+				data = ptr;
+			}
 			break;
 		case CURLINFO_DATA_OUT:
-            fwrite(data, 1, size, idx->logfp);
+		case CURLINFO_DATA_IN:
+            fwrite(data, 1, size, fp);
 			break;
 		case CURLINFO_HEADER_IN:
-            fprintf(idx->logfp, "%s < ", nowtime());
-            fwrite(data, 1, size, idx->logfp);
-			break;
-		case CURLINFO_DATA_IN:
-            fwrite(data, 1, size, idx->logfp);
+            fprintf(fp, "%s < ", time);
+            fwrite(data, 1, size, fp);
 			break;
 		case CURLINFO_TEXT:
-            fprintf(idx->logfp, "%s * ", nowtime());
-            fwrite(data, 1, size, idx->logfp);
+            fprintf(fp, "%s * ", time);
+            fwrite(data, 1, size, fp);
+			break;
+		case TRACE_BEGIN:
+            fprintf(fp, "%s * BEGIN %dst REQUEST\n", time, reqs);
+			break;
+		case TRACE_END:
+            fprintf(fp, "%s * END %dst REQUEST - %lf\n", time, reqs, size == sizeof(double) ? *(const double*) data : 0);
 			break;
 	}
-
-	return 0;
 }
 
-size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
-    const config_t *cfg = (const config_t *) userdata;
+static void trace_copy(trace_ring_t *r, unsigned long int pos, const void *src, size_t n) {
+    size_t off = pos & (TRACE_RING_SIZE - 1), first = TRACE_RING_SIZE - off;
 
-    if(cfg->isatty_stderr) {
-        return size * nmemb;
+    if(first >= n) {
+        memcpy(r->buf + off, src, n);
     } else {
-        return fwrite(ptr, size, nmemb, stderr);
+        memcpy(r->buf + off, src, first);
+        memcpy(r->buf, (const char*) src + first, n - first);
     }
 }
 
-size_t read_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
-    return fread(ptr, size, nmemb, (FILE*) userdata);
-}
+// hot path: copy the raw event into the ring, or drop it when the trace thread is behind
+void trace_write(trace_ring_t *r, int idx, int reqs, int type, const void *data, size_t size) {
+    trace_event_t ev;
+    unsigned long int head = r->head, total = (sizeof(ev) + size + 7) & ~7UL;
 
-size_t header_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
-	size_t written = size * nmemb;
-	idx_t *idx = (idx_t*) userdata;
-	
-	if(written >= 22 && !strncasecmp(ptr, "Connection: keep-alive", 22)) {
-		idx->keepalive = true;
-	}
-	
-	return written;
+    if(total > TRACE_RING_SIZE - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))) {
+        STAT_ADD(r->dropped, 1);
+        return;
+    }
+
+    ev.ns = nanotime();
+    ev.idx = idx;
+    ev.reqs = reqs;
+    ev.type = type;
+    ev.pad = 0;
+    ev.len = size;
+    trace_copy(r, head, &ev, sizeof(ev));
+    if(size) trace_copy(r, head + sizeof(ev), data, size);
+
+    __atomic_store_n(&r->head, head + total, __ATOMIC_RELEASE);
 }
 
-CURL *make_curl(const config_t *cfg, idx_t *idx) {
-    int i;
-    CURL *curl = (idx->curl ? idx->curl : curl_easy_init());
-    
-    idx->keepalive = false;
+int debug_handler(CURL *handle, curl_infotype type, char *data, size_t size, void *userp) {
+    idx_t *idx = (idx_t*) userp;
 
-    curl_easy_setopt(curl, CURLOPT_PRIVATE, idx);
-    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1);
-    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
-    // curl_easy_setopt(curl, CURLOPT_TRANSFER_ENCODING, 1L);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
-    curl_easy_setopt(curl, CURLOPT_HEADER, 0L);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, idx);
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, cfg);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    // request and response bytes are read from CURLINFO on completion
+    if(type == CURLINFO_TEXT) STAT_ADD(idx->worker->stats.bug_bytes, size);
 
-    if(idx->logfile) { // set DEBUG
-        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-        curl_easy_setopt(curl, CURLOPT_DEBUGDATA, idx);
-        curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, debug_handler);
+    if(type > CURLINFO_DATA_OUT) return 0;
 
-        if(!idx->logfp || access(idx->logfile, F_OK)) {
-            if(idx->logfp) fclose(idx->logfp);
-            idx->logfp = fopen(idx->logfile, "w");
-            if(!idx->logfp) fprintf(stderr, "open %s failure: %s\n", idx->logfile, strerror(errno));
-        }
-    } else if(cfg->verbose) { // set VERBOSE
-        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-        curl_easy_setopt(curl, CURLOPT_DEBUGDATA, idx);
-        curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, debug_handler);
-    } else {
-        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-        curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, debug_bytes_handler);
+    if(idx->worker->trace.buf) {
+        trace_write(&idx->worker->trace, idx->id, idx->reqs, type, data, size);
+    } else if(idx->logfp) {
+        debug_print(idx->logfp, nowtime(), type, data, size, idx->reqs);
     }
 
-    if(idx->logfp) fprintf(idx->logfp, "%s * BEGIN %dst REQUEST\n", nowtime(), ++ idx->reqs);
+	return 0;
+}
 
-    // weight
-    if(cfg->urlw) {
-        if(idx->w < cfg->urlw[idx->i]) {
-            i = idx->i;
-            if(++idx->w >= cfg->urlw[idx->i]) {
-                idx->i ++;
-                idx->w = 0;
-            }
-        } else {
-            idx->w = 0;
-            i = idx->i ++;
-        }
-    } else {
-        i = idx->i ++;
-    }
-    if(idx->i >= cfg->urlc) {
-        idx->i = 0;
+void write_all(int fd, const char *ptr, size_t size) {
+    ssize_t n;
+
+    while(size) {
+        n = write(fd, ptr, size);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        ptr += n;
+        size -= n;
     }
-    // printf("  %d => [%d] %s\n", i, cfg->urlw ? cfg->urlw[i] : 1, cfg->urls[i]);
+}
 
-    // set URL
-    curl_easy_setopt(curl, CURLOPT_URL, cfg->urls[i]);
+void body_flush(worker_t *w) {
+    write_all(w->body_fd, w->body_buf, w->body_len);
+    w->body_len = 0;
+}
 
-    // set HEADER
-    if(cfg->headerc) {
-        for(i=0; i<cfg->headerc; i++) {
-            idx->headers = curl_slist_append(idx->headers, cfg->headers[i]);
+void body_write(worker_t *w, const char *ptr, size_t size) {
+    if(w->body_len + size > BODY_BUFSIZE) {
+        body_flush(w);
+        if(size > BODY_BUFSIZE) {
+            write_all(w->body_fd, ptr, size);
+            return;
         }
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, idx->headers);
     }
+    memcpy(w->body_buf + w->body_len, ptr, size);
+    w->body_len += size;
+}
 
-    // set DATA
-    if(cfg->data) {
-        curl_easy_setopt(curl, CURLOPT_POST, 1L);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, cfg->data);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(cfg->data));
+void request_write(worker_t *w, const request_record_t *r) {
+    if(w->request_len + sizeof(*r) > BODY_BUFSIZE) {
+        write_all(w->cfg->request_log_fd, w->request_buf, w->request_len);
+        w->request_len = 0;
     }
+    memcpy(w->request_buf + w->request_len, r, sizeof(*r));
+    w->request_len += sizeof(*r);
+}
 
-    // set HEAD
-    if(cfg->head) curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+size_t write_discard(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    return size * nmemb;
+}
 
-    // set FORM
-    if(cfg->formc) {
-        struct curl_httppost *lastptr = NULL;
-        for(i=0; i<cfg->formc; i++) {
-            if(cfg->forms[i].is_file) {
-                if(access(cfg->forms[i].value, R_OK)) {
-                    fprintf(stderr, "form file not exists: name: %s, value: %s\n", cfg->forms[i].name, cfg->forms[i].value);
-                } else {
-                    curl_formadd(&idx->form, &lastptr,
-                        CURLFORM_PTRNAME, cfg->forms[i].name,
-                        CURLFORM_FILE, cfg->forms[i].value,
-                        CURLFORM_END
-                    );
-                }
-            } else {
-                curl_formadd(&idx->form, &lastptr,
-                    CURLFORM_PTRNAME, cfg->forms[i].name,
-                    CURLFORM_PTRCONTENTS, cfg->forms[i].value,
-                    CURLFORM_END
-                );
-            }
-        }
-        curl_easy_setopt(curl, CURLOPT_HTTPPOST, idx->form);
-    }
+size_t write_stderr(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    idx_t *idx = (idx_t*) userdata;
 
-    // set COOKIE
-    if(cfg->cookie) curl_easy_setopt(curl, CURLOPT_COOKIE, cfg->cookie);
+    body_write(idx->worker, ptr, size * nmemb);
 
-    // set COOKIE_FILE
-    if(cfg->cookie_file) {
-        curl_easy_setopt(curl, CURLOPT_COOKIEFILE, cfg->cookie_file);
-        curl_easy_setopt(curl, CURLOPT_COOKIEJAR, cfg->cookie_file);
-    }
+    return size * nmemb;
+}
 
-    // set COOKIE_SESSION
-    if(cfg->cookie_session) curl_easy_setopt(curl, CURLOPT_COOKIESESSION, cfg->cookie_session);
+size_t write_checksum(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    idx_t *idx = (idx_t*) userdata;
 
-    if(cfg->append) curl_easy_setopt(curl, CURLOPT_APPEND, 1L);
-    if(cfg->upload_file) {
-        idx->fp_upload = fopen(cfg->upload_file, "r");
-        if(idx->fp_upload) {
-            fseek(idx->fp_upload, 0, SEEK_END);
-            curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
-            curl_easy_setopt(curl, CURLOPT_READDATA, (void*) idx->fp_upload);
-            curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
-            curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t) ftell(idx->fp_upload));
-            fseek(idx->fp_upload, 0, SEEK_SET);
-        } else {
-            fprintf(stderr, "open %s failure: %s\n", cfg->upload_file, strerror(errno));
-        }
-    }
+    idx->crc = crc32(idx->crc, (const Bytef*) ptr, size * nmemb);
 
-#if 1
-    // set KEEPALIVE
-    if(cfg->keepalive) {
-        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, cfg->keepalive);
-        curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, cfg->keepalive);
-        curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, cfg->keepalive);
-        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    return size * nmemb;
+}
+
+void sample_append(idx_t *idx, const char *ptr, size_t size) {
+    if(idx->sample_len + size > idx->sample_size) {
+        idx->sample_size = (idx->sample_len + size) * 2;
+        idx->sample_buf = (char*) realloc(idx->sample_buf, idx->sample_size);
     }
-#endif
+    memcpy(idx->sample_buf + idx->sample_len, ptr, size);
+    idx->sample_len += size;
+}
 
-    // set TIMEOUT
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, cfg->timeout);
+size_t write_sample(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    idx_t *idx = (idx_t*) userdata;
 
-    // set CONNECT_TIMEOUT
-	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, cfg->connect_timeout);
+    if(idx->sample) sample_append(idx, ptr, size * nmemb);
+
+    return size * nmemb;
+}
+
+// substring search over a stream, the last needle - 1 bytes of a chunk are kept for the next one
+bool expect_search(const expect_t *e, char *carry, unsigned short *carry_len, const char *ptr, size_t n) {
+    char tmp[2 * EXPECT_NEEDLE];
+    size_t c = *carry_len, head = n < e->value_len - 1 ? n : e->value_len - 1, keep;
+
+    memcpy(tmp, carry, c);
+    memcpy(tmp + c, ptr, head);
+    if(memmem(tmp, c + head, e->value, e->value_len)) return true;
+    if(memmem(ptr, n, e->value, e->value_len)) return true;
+
+    keep = e->value_len - 1;
+    if(n >= keep) {
+        memcpy(carry, ptr + n - keep, keep);
+    } else {
+        if(c + n > keep) c = keep - n;
+        memcpy(carry, tmp + *carry_len - c, c);
+        memcpy(carry + c, ptr, n);
+        keep = c + n;
+    }
+    *carry_len = keep;
+
+    return false;
+}
+
+size_t write_expect(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    idx_t *idx = (idx_t*) userdata;
+    const config_t *cfg = idx->worker->cfg;
+    size_t n = size * nmemb;
+    int i;
+
+    idx->expect_size += n;
+    if(cfg->expect_buffer && idx->expect_body_len < BODY_BUFSIZE) {
+        size_t len = BODY_BUFSIZE - idx->expect_body_len;
+
+        if(len > n) len = n;
+        memcpy(idx->expect_body + idx->expect_body_len, ptr, len);
+        idx->expect_body_len += len;
+    }
+    for(i=0; i<cfg->expectc; i++) {
+        if(cfg->expects[i].type != EXPECT_BODY || idx->expect_met[i]) continue;
+        idx->expect_met[i] = expect_search(&cfg->expects[i], idx->expect_carry + i * (EXPECT_NEEDLE - 1), &idx->expect_carry_len[i], ptr, n);
+    }
+
+    return cfg->sink(ptr, size, nmemb, userdata);
+}
+
+size_t header_expect(char *buffer, size_t size, size_t nitems, void *userdata) {
+    idx_t *idx = (idx_t*) userdata;
+    const config_t *cfg = idx->worker->cfg;
+    size_t n = size * nitems;
+    int i;
+
+    for(i=0; i<cfg->expectc; i++) {
+        const expect_t *e = &cfg->expects[i];
+
+        if(e->type != EXPECT_HEADER) continue;
+        // the headers of a redirect or a 100 Continue do not count
+        if(n >= 5 && !memcmp(buffer, "HTTP/", 5)) {
+            idx->expect_met[i] = false;
+        } else if(!idx->expect_met[i] && n > e->name_len && buffer[e->name_len] == ':' && !strncasecmp(buffer, e->name, e->name_len)) {
+            idx->expect_met[i] = !e->value || memmem(buffer + e->name_len + 1, n - e->name_len - 1, e->value, e->value_len);
+        }
+    }
+
+    return n;
+}
+
+const char *json_ws(const char *p, const char *end) {
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    return p;
+}
+
+// the end of the string starting at p, NULL if it is cut off
+const char *json_string(const char *p, const char *end) {
+    for(p++; p < end; p++) {
+        if(*p == '\\') p++;
+        else if(*p == '"') return p + 1;
+    }
+    return NULL;
+}
+
+// the end of the value starting at p, NULL if it is cut off
+const char *json_skip(const char *p, const char *end) {
+    int depth = 0;
+
+    if(p >= end) return NULL;
+    if(*p == '"') return json_string(p, end);
+    if(*p != '{' && *p != '[') {
+        while(p < end && !strchr(",}] \t\r\n", *p)) p++;
+        return p;
+    }
+    while(p < end) {
+        if(*p == '"') {
+            if(!(p = json_string(p, end))) return NULL;
+            continue;
+        }
+        if(*p == '{' || *p == '[') depth++;
+        else if((*p == '}' || *p == ']') && !--depth) return p + 1;
+        p++;
+    }
+    return NULL;
+}
+
+// follows a path like "data.items[0].id" from the document root, returns the value or NULL
+const char *json_find(const char *p, const char *end, const char *path, size_t path_len) {
+    const char *seg, *path_end = path + path_len;
+    size_t len;
+    long int i;
+
+    p = json_ws(p, end);
+    while(path < path_end) {
+        if(*path == '.') path++;
+        if(path < path_end && *path == '[') {
+            i = strtol(path + 1, (char**) &seg, 10);
+            if(*seg != ']' || p >= end || *p != '[') return NULL;
+            path = seg + 1;
+            p = json_ws(p + 1, end);
+            for(; i > 0; i--) {
+                if(!(p = json_skip(p, end))) return NULL;
+                p = json_ws(p, end);
+                if(p >= end || *p != ',') return NULL;
+                p = json_ws(p + 1, end);
+            }
+            if(p >= end || *p == ']') return NULL;
+            continue;
+        }
+
+        seg = path;
+        for(len=0; path + len < path_end && path[len] != '.' && path[len] != '['; len++);
+        path += len;
+        if(p >= end || *p != '{') return NULL;
+        p = json_ws(p + 1, end);
+        while(true) {
+            const char *key = p;
+
+            if(p >= end || *p != '"' || !(p = json_string(p, end))) return NULL;
+            p = json_ws(p, end);
+            if(p >= end || *p != ':') return NULL;
+            p = json_ws(p + 1, end);
+            if((size_t) (p - key) >= len + 2 && !strncmp(key + 1, seg, len) && key[len + 1] == '"') break;
+            if(!(p = json_skip(p, end))) return NULL;
+            p = json_ws(p, end);
+            if(p >= end || *p != ',') return NULL;
+            p = json_ws(p + 1, end);
+        }
+    }
+
+    return p;
+}
+
+// evaluates the expectations of a finished request, returns whether any of them failed
+bool expect_check(const config_t *cfg, idx_t *idx, long code, stats_t *stats) {
+    bool failed = false, met;
+    int i;
+
+    for(i=0; i<cfg->expectc; i++) {
+        const expect_t *e = &cfg->expects[i];
+
+        switch(e->type) {
+            case EXPECT_STATUS:
+                met = code >= e->min && code <= e->max;
+                break;
+            case EXPECT_SIZE:
+                met = (long int) idx->expect_size >= e->min && (e->max < 0 || (long int) idx->expect_size <= e->max);
+                break;
+            case EXPECT_REGEX:
+                idx->expect_body[idx->expect_body_len] = '\0';
+                met = !regexec(&e->re, idx->expect_body, 0, NULL, 0);
+                break;
+            case EXPECT_JSON: {
+                const char *end = idx->expect_body + idx->expect_body_len, *p = json_find(idx->expect_body, end, e->name, e->name_len), *q;
+
+                met = false;
+                if(p && (q = json_skip(p, end))) {
+                    if(*p == '"') p++, q--;
+                    met = (size_t) (q - p) == e->value_len && !memcmp(p, e->value, e->value_len);
+                }
+                break;
+            }
+            default:
+                met = idx->expect_met[i];
+                break;
+        }
+        if(!met) {
+            STAT_ADD(stats->expect_fails[i], 1);
+            failed = true;
+        }
+    }
+
+    return failed;
+}
+
+void expect_reset(idx_t *idx) {
+    memset(idx->expect_met, 0, sizeof(idx->expect_met));
+    memset(idx->expect_carry_len, 0, sizeof(idx->expect_carry_len));
+    idx->expect_body_len = 0;
+    idx->expect_size = 0;
+}
+
+static volatile bool trace_running = false;
+
+// write everything the workers have published with one writev(), returns the bytes written
+long int trace_drain(worker_t *workers, int n, int fd) {
+    struct iovec iov[2 * n], *v = iov;
+    unsigned long int heads[n], head, tail, off;
+    int i, iovc = 0;
+    long int total = 0;
+    ssize_t ret;
+
+    for(i=0; i<n; i++) {
+        trace_ring_t *r = &workers[i].trace;
+
+        head = heads[i] = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        tail = r->tail;
+        if(head == tail) continue;
+
+        off = tail & (TRACE_RING_SIZE - 1);
+        iov[iovc].iov_base = r->buf + off;
+        iov[iovc].iov_len = (head - tail < TRACE_RING_SIZE - off ? head - tail : TRACE_RING_SIZE - off);
+        total += iov[iovc++].iov_len;
+        if(head - tail > TRACE_RING_SIZE - off) {
+            iov[iovc].iov_base = r->buf;
+            iov[iovc].iov_len = head - tail - (TRACE_RING_SIZE - off);
+            total += iov[iovc++].iov_len;
+        }
+    }
+    if(!iovc) return 0;
+
+    while(iovc) {
+        ret = writev(fd, v, iovc);
+        if(ret < 0 && errno == EINTR) continue;
+        if(ret <= 0) break;
+        while(iovc && ret >= v->iov_len) {
+            ret -= v->iov_len;
+            v ++;
+            iovc --;
+        }
+        if(iovc) {
+            v->iov_base = (char*) v->iov_base + ret;
+            v->iov_len -= ret;
+        }
+    }
+
+    for(i=0; i<n; i++) {
+        __atomic_store_n(&workers[i].trace.tail, heads[i], __ATOMIC_RELEASE);
+    }
+
+    return total;
+}
+
+void *trace_run(void *arg) {
+    worker_t *workers = (worker_t*) arg;
+    const config_t *cfg = workers[0].cfg;
+
+    while(trace_running) {
+        if(!trace_drain(workers, cfg->threads, cfg->trace_fd)) usleep(1000);
+    }
+    trace_drain(workers, cfg->threads, cfg->trace_fd);
+
+    return NULL;
+}
+
+// --decode: turn a -D trace back into the .debug-NNN.log text files next to it, or print a --request-log as CSV
+int trace_decode(const char *path) {
+    trace_header_t hdr;
+    trace_event_t ev;
+    FILE *fp, **fps;
+    char *path2, *dir, *buf = NULL, fmt[64], time[64], *logfile;
+    size_t bufsize = 0, len;
+    long int ns;
+    int i;
+
+    fp = fopen(path, "r");
+    if(!fp) {
+        fprintf(stderr, "open %s failure: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if(fread(&hdr, sizeof(hdr.magic), 1, fp) == 1 && !memcmp(hdr.magic, REQUEST_LOG_MAGIC, sizeof(hdr.magic))) {
+        request_record_t r;
+
+        printf("time,idx,reqs,url,code,req_bytes,res_bytes,latency_us");
+        for(i=0; i<PHASES; i++) printf(",%s_us", phase_names[i]);
+        printf("\n");
+        while(fread(&r, sizeof(r), 1, fp) == 1) {
+            printf("%ld.%06ld,%u,%u,%u,%d,%ld,%ld,%u", (long int) (r.time / 1000000), (long int) (r.time % 1000000), r.idx, r.reqs, r.url, r.code, (long int) r.req_bytes, (long int) r.res_bytes, r.latency);
+            for(i=0; i<PHASES; i++) printf(",%u", r.phases[i]);
+            printf("\n");
+        }
+        fclose(fp);
+        return 0;
+    }
+    rewind(fp);
+    if(fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) || hdr.concurrency <= 0) {
+        fprintf(stderr, "%s is not a curl-multi trace\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    path2 = strdup(path);
+    dir = dirname(path2);
+    snprintf(fmt, sizeof(fmt), "%%s/.debug-%%0%dd.log", (int) ceil(log10(hdr.concurrency+1)));
+    fps = (FILE**) calloc(hdr.concurrency, sizeof(FILE*));
+
+    while(fread(&ev, sizeof(ev), 1, fp) == 1) {
+        len = ((sizeof(ev) + ev.len + 7) & ~7UL) - sizeof(ev);
+        if(len > bufsize) {
+            bufsize = len;
+            buf = (char*) realloc(buf, bufsize);
+        }
+        if(len && fread(buf, 1, len, fp) != len) break;
+        if(ev.idx < 1 || ev.idx > hdr.concurrency) continue;
+
+        if(!fps[ev.idx - 1]) {
+            asprintf(&logfile, fmt, dir, ev.idx);
+            fps[ev.idx - 1] = fopen(logfile, "w");
+            if(!fps[ev.idx - 1]) fprintf(stderr, "open %s failure: %s\n", logfile, strerror(errno));
+            free(logfile);
+            if(!fps[ev.idx - 1]) break;
+        }
+
+        ns = hdr.realtime + ((long int) ev.ns - hdr.monotonic);
+        fmttime(ns / 1000000000L, ns % 1000000000L / 1000, time, sizeof(time));
+        debug_print(fps[ev.idx - 1], time, ev.type, buf, ev.len, ev.reqs);
+    }
+
+    for(i=0; i<hdr.concurrency; i++) {
+        if(fps[i]) fclose(fps[i]);
+    }
+    free(fps);
+    free(buf);
+    free(path2);
+    fclose(fp);
+
+    return 0;
+}
+
+size_t read_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    mem_cursor_t *m = (mem_cursor_t*) userdata;
+    size_t n = size * nmemb;
+
+    if(n > m->size - m->pos) n = m->size - m->pos;
+    memcpy(ptr, m->data + m->pos, n);
+    m->pos += n;
+
+    return n;
+}
+
+// libcurl rewinds for redirects and retries, and a mime part on every request
+int seek_callback(void *userdata, curl_off_t offset, int origin) {
+    mem_cursor_t *m = (mem_cursor_t*) userdata;
+
+    if(origin == SEEK_CUR) {
+        offset += m->pos;
+    } else if(origin == SEEK_END) {
+        offset += m->size;
+    }
+    if(offset < 0 || (size_t) offset > m->size) return CURL_SEEKFUNC_FAIL;
+    m->pos = offset;
+
+    return CURL_SEEKFUNC_OK;
+}
+
+// the whole file read-only, an empty one is ""
+char *map_file(const char *path, size_t *size) {
+    struct stat st;
+    char *map;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "open %s failure: %s\n", path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return NULL;
+    }
+    *size = st.st_size;
+    if(!st.st_size) {
+        close(fd);
+        return (char*) "";
+    }
+    map = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "mmap %s failure: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    return map;
+}
+
+void unmap_file(char *map, size_t size) {
+    if(map && size) munmap(map, size);
+}
+
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    pthread_mutex_lock(&share_locks[data]);
+}
+
+void share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    pthread_mutex_unlock(&share_locks[data]);
+}
+
+// DNS cache and TLS session IDs shared by the handles of all workers,
+// the connection cache is already shared by all handles of one multi handle
+CURLSH *make_share(void) {
+    CURLSH *sh = curl_share_init();
+    int i;
+
+    for(i=0; i<CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&share_locks[i], NULL);
+    }
+
+    curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+    return sh;
+}
+
+// libcurl does not tell whether a TLS session was resumed, ask OpenSSL when libcurl is built with it
+static int (*ssl_session_reused)(void *ssl) = NULL;
+static void (*ssl_alpn_selected)(const void *ssl, const unsigned char **data, unsigned int *len) = NULL;
+
+conn_t *conn_open(worker_t *w, int fd, const char *peer, int peer_port, int port) {
+    conn_t *conn = &w->conns[fd];
+
+    conn->opened = nanotime();
+    conn->port = port & (CONN_PORTS - 1);
+    conn->peer_port = peer_port;
+    snprintf(conn->peer, sizeof(conn->peer), "%s", peer);
+    conn->next = w->port_conns[conn->port];
+    w->port_conns[conn->port] = fd;
+    STAT_ADD(w->stats.keepalives, 1);
+
+    return conn;
+}
+
+conn_t *conn_find(worker_t *w, const char *peer, int peer_port, int port) {
+    int fd;
+
+    for(fd = w->port_conns[port & (CONN_PORTS - 1)]; fd >= 0; fd = w->conns[fd].next) {
+        if(w->conns[fd].peer_port == peer_port && !strcmp(w->conns[fd].peer, peer)) return &w->conns[fd];
+    }
+
+    return NULL;
+}
+
+void conn_close(worker_t *w, int fd) {
+    conn_t *conn = &w->conns[fd];
+    int *p = &w->port_conns[conn->port];
+
+    hist_record(&w->stats.conn_reqs, conn->reqs);
+    hist_record(&w->stats.conn_life, (nanotime() - conn->opened) / 1000);
+    STAT_ADD(w->stats.keepalives, -1);
+    conn->reqs = 0;
+    while(*p >= 0 && *p != fd) p = &w->conns[*p].next;
+    if(*p == fd) *p = conn->next;
+}
+
+// called once a request has its connection, new or reused
+int prereq_callback(void *userdata, char *conn_primary_ip, char *conn_local_ip, int conn_primary_port, int conn_local_port) {
+    idx_t *idx = (idx_t*) userdata;
+    worker_t *w = idx->worker;
+    conn_t *conn = NULL;
+    stats_t *stats = idx->warmup ? &w->warmup : &w->stats;
+    struct curl_tlssessioninfo *info = NULL;
+    long connects = 0;
+    bool h2 = (w->cfg->http_version == CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+
+    // CURLINFO_ACTIVESOCKET is unset until the transfer is done, but the handle that opens a connection sends its first request
+    curl_easy_getinfo(idx->curl, CURLINFO_NUM_CONNECTS, &connects);
+    if(connects <= 0) conn = conn_find(w, conn_primary_ip, conn_primary_port, conn_local_port);
+    if(!conn) {
+        if(connects > 0 && idx->sock != CURL_SOCKET_BAD && idx->sock < w->connc) {
+            if(w->conns[idx->sock].reqs) conn_close(w, idx->sock); // its close went unseen
+            conn = conn_open(w, idx->sock, conn_primary_ip, conn_primary_port, conn_local_port);
+        }
+        STAT_ADD(stats->new_conns, 1);
+    } else {
+        STAT_ADD(stats->reused_conns, 1);
+    }
+    // --requests-per-conn: libcurl closes the connection after its last request
+    if(conn && ++conn->reqs == w->cfg->requests_per_conn) curl_easy_setopt(idx->curl, CURLOPT_FORBID_REUSE, 1L);
+
+    idx->tls_conn = idx->tls_resumed = false;
+    if(w->cfg->tls && !curl_easy_getinfo(idx->curl, CURLINFO_TLS_SSL_PTR, &info) && info && info->backend != CURLSSLBACKEND_NONE && info->internals) {
+        idx->tls_conn = true;
+        if(ssl_session_reused && info->backend == CURLSSLBACKEND_OPENSSL) idx->tls_resumed = ssl_session_reused(info->internals);
+        // over TLS the server may answer --http2 with HTTP/1.1, ALPN tells
+        if(ssl_alpn_selected && info->backend == CURLSSLBACKEND_OPENSSL) {
+            const unsigned char *alpn = NULL;
+            unsigned int len = 0;
+
+            ssl_alpn_selected(info->internals, &alpn, &len);
+            h2 = (len == 2 && !memcmp(alpn, "h2", 2));
+        }
+    }
+    // a stream is open from here until the transfer is done, redirects stay on the same one
+    if(w->cfg->http_version && h2 && !idx->stream) {
+        idx->stream = true;
+        STAT_ADD(w->stats.streams, 1);
+    }
+
+    return CURL_PREREQFUNC_OK;
+}
+
+// open sockets are the connections in use, opensocket is called with the idx, closesocket with the worker
+curl_socket_t opensocket_callback(void *clientp, curlsocktype purpose, struct curl_sockaddr *address) {
+    idx_t *idx = (idx_t*) clientp;
+    worker_t *w = idx->worker;
+    curl_socket_t fd = socket(address->family, address->socktype, address->protocol);
+
+    if(fd != CURL_SOCKET_BAD) {
+        STAT_ADD(w->stats.connections, 1);
+        if(fd >= w->connc) {
+            int n = fd < 1024 ? 1024 : fd * 2;
+
+            w->conns = (conn_t*) realloc(w->conns, n * sizeof(conn_t));
+            memset(w->conns + w->connc, 0, (n - w->connc) * sizeof(conn_t));
+            w->connc = n;
+        }
+    }
+    idx->sock = fd;
+
+    return fd;
+}
+
+int closesocket_callback(void *clientp, curl_socket_t item) {
+    worker_t *w = (worker_t*) clientp;
+
+    if(item >= 0 && item < w->connc && w->conns[item].reqs) conn_close(w, item);
+    STAT_ADD(w->stats.connections, -1);
+
+    return close(item);
+}
+
+// options shared by all requests are set once on a template handle, idx handles are duplicated from it
+CURL *make_template(config_t *cfg) {
+    int i;
+    CURL *curl = curl_easy_init();
+
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    // curl_easy_setopt(curl, CURLOPT_TRANSFER_ENCODING, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
+    curl_easy_setopt(curl, CURLOPT_HEADER, 0L);
+    switch(cfg->body) {
+        case BODY_STDERR:
+            cfg->sink = write_stderr;
+            break;
+        case BODY_CHECKSUM:
+            cfg->sink = write_checksum;
+            break;
+        case BODY_SAMPLE:
+            cfg->sink = write_sample;
+            break;
+        default:
+            cfg->sink = write_discard;
+            break;
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, cfg->expectc ? write_expect : cfg->sink);
+    if(cfg->expect_header) curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_expect);
+
+    // set HEADER
+    if(cfg->headerc) {
+        for(i=0; i<cfg->headerc; i++) {
+            cfg->header_list = curl_slist_append(cfg->header_list, cfg->headers[i]);
+        }
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, cfg->header_list);
+
+        // corpus entries send their own headers followed by the -H ones
+        for(i=0; i<cfg->corpusc; i++) {
+            struct curl_slist *h = cfg->corpus[i].headers;
+
+            while(h && h->next) h = h->next;
+            if(h) h->next = cfg->header_list;
+        }
+    }
+
+    // set DATA
+    if(cfg->data) {
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, cfg->data);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(cfg->data));
+    }
+
+    // set HEAD
+    if(cfg->head) curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+
+    // FORM is set by make_mime() for every handle
+
+    // set COOKIE
+    if(cfg->cookie) curl_easy_setopt(curl, CURLOPT_COOKIE, cfg->cookie);
+
+    // set COOKIE_FILE
+    if(cfg->cookie_file) {
+        curl_easy_setopt(curl, CURLOPT_COOKIEFILE, cfg->cookie_file);
+        curl_easy_setopt(curl, CURLOPT_COOKIEJAR, cfg->cookie_file);
+    }
+
+    // set COOKIE_SESSION
+    if(cfg->cookie_session) curl_easy_setopt(curl, CURLOPT_COOKIESESSION, cfg->cookie_session);
+
+    if(cfg->append) curl_easy_setopt(curl, CURLOPT_APPEND, 1L);
+    if(cfg->upload_map) {
+        curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+        curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
+        curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, seek_callback);
+        curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t) cfg->upload_size);
+    }
+
+#if 1
+    // set KEEPALIVE
+    if(cfg->keepalive) {
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, cfg->keepalive);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, cfg->keepalive);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, cfg->keepalive);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    }
+#endif
+
+    // set NO_REUSE
+    if(cfg->no_reuse) {
+        curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1L);
+        curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 1L);
+    }
+
+    // set HTTP_VERSION, wait for a connection to multiplex on instead of opening a new one
+    if(cfg->http_version) {
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, cfg->http_version);
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+
+    // connection stats: the sockets, and the connection every request starts on
+    curl_easy_setopt(curl, CURLOPT_OPENSOCKETFUNCTION, opensocket_callback);
+    curl_easy_setopt(curl, CURLOPT_CLOSESOCKETFUNCTION, closesocket_callback);
+    curl_easy_setopt(curl, CURLOPT_PREREQFUNCTION, prereq_callback);
+
+    // set INSECURE
+    if(cfg->insecure) {
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+
+    // TLS handshake stats
+    for(i=0; i<cfg->urlc && !cfg->tls; i++) {
+        cfg->tls = !strncasecmp(cfg->urls[i], "https://", 8);
+    }
+    if(cfg->tls) ssl_session_reused = (int (*)(void*)) dlsym(RTLD_DEFAULT, "SSL_session_reused");
+    if(cfg->tls && cfg->http_version) ssl_alpn_selected = (void (*)(const void*, const unsigned char**, unsigned int*)) dlsym(RTLD_DEFAULT, "SSL_get0_alpn_selected");
+
+    // set TIMEOUT
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, cfg->timeout);
+
+    // set CONNECT_TIMEOUT
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, cfg->connect_timeout);
+
+    // set GET
+    if(cfg->get) curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+
+    // set METHOD
+    if(cfg->method) curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, cfg->method);
+
+    return curl;
+}
+
+static long int corpus_next = 0;
+
+// --corpus: entries are
+//   [@<unix time>] <METHOD> <URL>
+//   <Header>: <value>
+//   ...
+//   <empty line>
+//   <Content-Length bytes of body>
+// the file is mapped privately and its lines are terminated in place, so that entries point into the mapping
+int corpus_load(config_t *cfg, const char *path) {
+    struct stat st;
+    char *p, *end, *eol, *q;
+    long int entryc = 0, nodec = 0, nodes = 0, i, *firsts = NULL, *counts = NULL;
+    double last = 0;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "open %s failure: %s\n", path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    if(st.st_size <= 0) {
+        fprintf(stderr, "corpus %s is empty\n", path);
+        close(fd);
+        return -1;
+    }
+    cfg->corpus_size = st.st_size;
+    cfg->corpus_map = (char*) mmap(NULL, cfg->corpus_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(cfg->corpus_map == MAP_FAILED) {
+        fprintf(stderr, "mmap %s failure: %s\n", path, strerror(errno));
+        cfg->corpus_map = NULL;
+        return -1;
+    }
+    madvise(cfg->corpus_map, cfg->corpus_size, MADV_SEQUENTIAL);
+
+    p = cfg->corpus_map;
+    end = p + cfg->corpus_size;
+    // lines are terminated in place at their newline, so every line needs one, the last too
+    if(end[-1] != '\n') {
+        fprintf(stderr, "corpus %s must end with a newline\n", path);
+        return -1;
+    }
+
+    while(p < end) {
+        corpus_entry_t *e;
+
+        eol = (char*) memchr(p, '\n', end - p);
+        if(eol == p || (eol == p + 1 && *p == '\r')) {
+            p = eol + 1;
+            continue;
+        }
+
+        if(entryc % 4096 == 0) {
+            cfg->corpus = (corpus_entry_t*) realloc(cfg->corpus, sizeof(corpus_entry_t) * (entryc + 4096));
+            firsts = (long int*) realloc(firsts, sizeof(long int) * (entryc + 4096));
+            counts = (long int*) realloc(counts, sizeof(long int) * (entryc + 4096));
+        }
+        e = &cfg->corpus[entryc];
+        memset(e, 0, sizeof(*e));
+        firsts[entryc] = nodec;
+        counts[entryc] = 0;
+
+        // request line
+        if(eol > p && eol[-1] == '\r') eol[-1] = '\0';
+        *eol = '\0';
+        if(*p == '@') {
+            last = strtod(p + 1, &q);
+            p = q;
+            while(*p == ' ' || *p == '\t') p ++;
+        }
+        e->time = last;
+        e->method = p;
+        q = strpbrk(p, " \t");
+        if(!q) {
+            fprintf(stderr, "corpus %s entry %ld: no URL in \"%s\"\n", path, entryc + 1, p);
+            free(firsts);
+            free(counts);
+            return -1;
+        }
+        *q++ = '\0';
+        while(*q == ' ' || *q == '\t') q ++;
+        e->url = q;
+        if(!cfg->tls) cfg->tls = !strncasecmp(e->url, "https://", 8);
+        p = eol + 1;
+
+        // headers up to an empty line, Content-Length is only used to find the body
+        while(p < end) {
+            eol = (char*) memchr(p, '\n', end - p);
+            if(eol > p && eol[-1] == '\r') eol[-1] = '\0';
+            *eol = '\0';
+            if(!*p) {
+                p = eol + 1;
+                break;
+            }
+            if(!strncasecmp(p, "Content-Length:", 15)) {
+                e->body_len = atol(p + 15);
+            } else {
+                if(nodec >= nodes) {
+                    nodes = nodes ? nodes * 2 : 4096;
+                    cfg->corpus_headers = (struct curl_slist*) realloc(cfg->corpus_headers, sizeof(struct curl_slist) * nodes);
+                }
+                cfg->corpus_headers[nodec].data = p;
+                cfg->corpus_headers[nodec++].next = NULL;
+                counts[entryc] ++;
+            }
+            p = eol + 1;
+        }
+
+        if(e->body_len > 0) {
+            if(e->body_len > end - p) {
+                fprintf(stderr, "corpus %s entry %ld: body is cut short\n", path, entryc + 1);
+                free(firsts);
+                free(counts);
+                return -1;
+            }
+            e->body = p;
+            p += e->body_len;
+        } else if(!strcmp(e->method, "POST") || !strcmp(e->method, "PUT") || !strcmp(e->method, "PATCH")) {
+            e->body = p; // empty body, not a GET
+        }
+        entryc ++;
+    }
+
+    // the nodes do not move anymore, link the headers of every entry
+    for(i=0; i<entryc; i++) {
+        long int j;
+
+        if(!counts[i]) continue;
+        cfg->corpus[i].headers = &cfg->corpus_headers[firsts[i]];
+        for(j=0; j+1<counts[i]; j++) {
+            cfg->corpus_headers[firsts[i] + j].next = &cfg->corpus_headers[firsts[i] + j + 1];
+        }
+    }
+    free(firsts);
+    free(counts);
+
+    cfg->corpusc = entryc;
+    if(!entryc) {
+        fprintf(stderr, "corpus %s has no entries\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static long int tmpl_seq = 0;
+static tmpl_file_t *tmpl_files[16];
+static int tmpl_filec = 0;
+
+// {{line:<file>}} files are mapped once however many placeholders name them
+tmpl_file_t *tmpl_file(const char *path) {
+    tmpl_file_t *f;
+    const char *p, *end;
+    int i, len;
+
+    for(i=0; i<tmpl_filec; i++) {
+        if(!strcmp(tmpl_files[i]->path, path)) return tmpl_files[i];
+    }
+    if(tmpl_filec >= sizeof(tmpl_files)/sizeof(tmpl_files[0])) {
+        fprintf(stderr, "template files too many: %s\n", path);
+        return NULL;
+    }
+
+    f = (tmpl_file_t*) calloc(1, sizeof(tmpl_file_t));
+    f->map = map_file(path, &f->size);
+    if(!f->map) {
+        free(f);
+        return NULL;
+    }
+    for(p=f->map; p<f->map + f->size; p++) {
+        if(*p == '\n') f->linec ++;
+    }
+    f->lines = malloc(sizeof(f->lines[0]) * (f->linec + 1));
+    f->linec = 0;
+    for(p=f->map; p<f->map + f->size; p=end + 1) {
+        end = memchr(p, '\n', f->map + f->size - p);
+        if(!end) end = f->map + f->size;
+        len = end - p;
+        if(len && p[len - 1] == '\r') len --;
+        if(!len) continue;
+        f->lines[f->linec].ptr = p;
+        f->lines[f->linec++].len = len;
+        if(len > f->max_len) f->max_len = len;
+    }
+    if(!f->linec) {
+        fprintf(stderr, "template file %s has no lines\n", path);
+        unmap_file(f->map, f->size);
+        free(f->lines);
+        free(f);
+        return NULL;
+    }
+    // registered once it is valid, a later placeholder naming it gets it back
+    f->path = strdup(path);
+    tmpl_files[tmpl_filec++] = f;
+
+    return f;
+}
+
+// *out stays NULL for a string without placeholders
+int tmpl_parse(const char *s, tmpl_t **out) {
+    tmpl_t *t;
+    tmpl_part_t *part;
+    const char *p = s, *open, *close, *name;
+    char *end, *path;
+    int len;
+
+    *out = NULL;
+    if(!strstr(s, "{{")) return 0;
+
+    t = (tmpl_t*) calloc(1, sizeof(tmpl_t));
+    t->parts = (tmpl_part_t*) calloc(strlen(s) / 2 + 2, sizeof(tmpl_part_t));
+    t->size = 1;
+    while(*p) {
+        open = strstr(p, "{{");
+        close = open ? strstr(open + 2, "}}") : NULL;
+        if(!close) open = p + strlen(p);
+        if(open > p) {
+            part = &t->parts[t->partc++];
+            part->type = TMPL_TEXT;
+            part->text = p;
+            part->len = open - p;
+            t->size += part->len;
+        }
+        if(!close) break;
+
+        part = &t->parts[t->partc++];
+        name = open + 2;
+        len = close - name;
+        if(len == 3 && !strncmp(name, "seq", 3)) {
+            part->type = TMPL_SEQ;
+            t->size += 20;
+        } else if(len == 3 && !strncmp(name, "idx", 3)) {
+            part->type = TMPL_IDX;
+            t->size += 10;
+        } else if(len == 4 && !strncmp(name, "uuid", 4)) {
+            part->type = TMPL_UUID;
+            t->size += 36;
+        } else if(!strncmp(name, "rand:", 5)) {
+            part->type = TMPL_RAND;
+            part->min = strtol(name + 5, &end, 10);
+            if(end == name + 5 || *end != '-') goto error;
+            name = end + 1;
+            part->max = strtol(name, &end, 10);
+            if(end == name || end != close || part->max < part->min) goto error;
+            t->size += 20;
+        } else if(!strncmp(name, "line:", 5)) {
+            part->type = TMPL_LINE;
+            path = strndup(name + 5, len - 5);
+            part->file = tmpl_file(path);
+            free(path);
+            if(!part->file) goto error;
+            t->size += part->file->max_len;
+        } else {
+            goto error;
+        }
+        p = close + 2;
+    }
+    *out = t;
+
+    return 0;
+
+error:
+    fprintf(stderr, "invalid placeholder: %.*s\n", (int) (close + 2 - open), open);
+    free(t->parts);
+    free(t);
+    return -1;
+}
+
+static char *tmpl_long(char *p, long int v) {
+    char tmp[24];
+    unsigned long int u = v < 0 ? -(unsigned long int) v : (unsigned long int) v;
+    int n = 0;
+
+    if(v < 0) *p++ = '-';
+    do {
+        tmp[n++] = '0' + u % 10;
+        u /= 10;
+    } while(u);
+    while(n) *p++ = tmp[--n];
+
+    return p;
+}
+
+// no allocation and no format parsing: buf has t->size bytes, seq is shared by the templates of a request
+size_t tmpl_render(const tmpl_t *t, char *buf, long int seq, idx_t *idx) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned short *seed = idx->worker->seed;
+    const tmpl_part_t *part;
+    unsigned char b[16];
+    char *p = buf;
+    long int r;
+    int i, j;
+
+    for(i=0; i<t->partc; i++) {
+        part = &t->parts[i];
+        switch(part->type) {
+            case TMPL_TEXT:
+                memcpy(p, part->text, part->len);
+                p += part->len;
+                break;
+            case TMPL_SEQ:
+                p = tmpl_long(p, seq);
+                break;
+            case TMPL_IDX:
+                p = tmpl_long(p, idx->id);
+                break;
+            case TMPL_RAND:
+                r = part->min + (long int) (erand48(seed) * ((double) part->max - part->min + 1));
+                p = tmpl_long(p, r > part->max ? part->max : r);
+                break;
+            case TMPL_UUID: // version 4
+                for(j=0; j<16; j+=4) {
+                    r = jrand48(seed);
+                    memcpy(b + j, &r, 4);
+                }
+                b[6] = (b[6] & 0x0f) | 0x40;
+                b[8] = (b[8] & 0x3f) | 0x80;
+                for(j=0; j<16; j++) {
+                    if(j == 4 || j == 6 || j == 8 || j == 10) *p++ = '-';
+                    *p++ = hex[b[j] >> 4];
+                    *p++ = hex[b[j] & 15];
+                }
+                break;
+            case TMPL_LINE: // lines in turn
+                r = (seq - 1) % part->file->linec;
+                memcpy(p, part->file->lines[r].ptr, part->file->lines[r].len);
+                p += part->file->lines[r].len;
+                break;
+        }
+    }
+    *p = '\0';
+
+    return p - buf;
+}
+
+void tmpl_free(tmpl_t *t) {
+    if(!t) return;
+    free(t->parts);
+    free(t);
+}
+
+// parses the <url>s, -d and -H once, and lays out the render buffer of an idx
+int tmpl_setup(config_t *cfg) {
+    size_t size = 0;
+    int i;
+
+    for(i=0; i<cfg->urlc; i++) {
+        tmpl_t *t;
+
+        if(tmpl_parse(cfg->urls[i], &t)) return -1;
+        if(!t) continue;
+        if(!cfg->url_tmpls) cfg->url_tmpls = (tmpl_t**) calloc(cfg->urlc, sizeof(tmpl_t*));
+        cfg->url_tmpls[i] = t;
+        if(t->size > size) size = t->size;
+    }
+    cfg->data_off = size;
+    if(cfg->data) {
+        if(tmpl_parse(cfg->data, &cfg->data_tmpl)) return -1;
+        if(cfg->data_tmpl) size += cfg->data_tmpl->size;
+    }
+    for(i=0; i<cfg->headerc; i++) {
+        if(tmpl_parse(cfg->headers[i], &cfg->header_tmpls[i])) return -1;
+        if(!cfg->header_tmpls[i]) continue;
+        cfg->header_templated = true;
+        cfg->header_offs[i] = size;
+        size += cfg->header_tmpls[i]->size;
+    }
+    if(cfg->header_templated && cfg->corpus) {
+        fprintf(stderr, "-H templates can not be used with --corpus\n");
+        return -1;
+    }
+    cfg->tmpl_size = size;
+    cfg->templated = (size > 0);
+
+    return 0;
+}
+
+void tmpl_cleanup(config_t *cfg) {
+    int i;
+
+    for(i=0; cfg->url_tmpls && i<cfg->urlc; i++) tmpl_free(cfg->url_tmpls[i]);
+    free(cfg->url_tmpls);
+    tmpl_free(cfg->data_tmpl);
+    for(i=0; i<cfg->headerc; i++) tmpl_free(cfg->header_tmpls[i]);
+    for(i=0; i<tmpl_filec; i++) {
+        unmap_file(tmpl_files[i]->map, tmpl_files[i]->size);
+        free(tmpl_files[i]->lines);
+        free(tmpl_files[i]->path);
+        free(tmpl_files[i]);
+    }
+}
+
+// every handle has its own mime, so that its -F @file parts read the mapping through its own cursors
+curl_mime *make_mime(const config_t *cfg, CURL *curl, idx_t *idx) {
+    curl_mime *mime = curl_mime_init(curl);
+    curl_mimepart *part;
+    int i;
+
+    if(!idx->forms) idx->forms = (mem_cursor_t*) calloc(cfg->formc, sizeof(mem_cursor_t));
+    for(i=0; i<cfg->formc; i++) {
+        part = curl_mime_addpart(mime);
+        curl_mime_name(part, cfg->forms[i].name);
+        if(cfg->forms[i].is_file) {
+            idx->forms[i].data = cfg->forms[i].map;
+            idx->forms[i].size = cfg->forms[i].size;
+            idx->forms[i].pos = 0;
+            curl_mime_data_cb(part, cfg->forms[i].size, read_callback, seek_callback, NULL, &idx->forms[i]);
+            curl_mime_filename(part, strrchr(cfg->forms[i].value, '/') ? strrchr(cfg->forms[i].value, '/') + 1 : cfg->forms[i].value);
+        } else {
+            curl_mime_data(part, cfg->forms[i].value, CURL_ZERO_TERMINATED);
+        }
+    }
+
+    return mime;
+}
+
+void idx_cleanup(idx_t *idx) {
+    if(idx->curl) {
+        curl_easy_cleanup(idx->curl);
+        idx->curl = NULL;
+    }
+    if(idx->mime) {
+        curl_mime_free(idx->mime);
+        idx->mime = NULL;
+    }
+}
+
+// --url-file: one "<url> [weight]" per line, added after the <url>s of the command line
+int url_file_load(config_t *cfg, const char *path) {
+    FILE *fp;
+    long int size;
+    char *line, *end, *p, **urls;
+    int *urlw, c, n = 1;
+
+    fp = fopen(path, "r");
+    if(!fp) {
+        fprintf(stderr, "open %s failure: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if(size < 0) {
+        fprintf(stderr, "read %s failure: %s\n", path, strerror(errno));
+        fclose(fp);
+        return -1;
+    }
+    cfg->url_buf = (char*) malloc(size + 1);
+    if(fread(cfg->url_buf, 1, size, fp) != (size_t) size) {
+        fprintf(stderr, "read %s failure: %s\n", path, strerror(errno));
+        free(cfg->url_buf);
+        cfg->url_buf = NULL;
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    cfg->url_buf[size] = '\0';
+
+    for(p=cfg->url_buf; *p; p++) {
+        if(*p == '\n') n ++;
+    }
+    urls = (char**) malloc(sizeof(char*) * (cfg->urlc + n));
+    urlw = (int*) malloc(sizeof(int) * (cfg->urlc + n));
+    for(c=0; c<cfg->urlc; c++) {
+        urls[c] = cfg->urls[c];
+        urlw[c] = cfg->urlw ? cfg->urlw[c] : 1;
+    }
+
+    // lines are terminated in place, blank ones and # comments are skipped
+    for(line=cfg->url_buf; *line; line=end) {
+        end = strchr(line, '\n');
+        if(end) {
+            *end++ = '\0';
+        } else {
+            end = line + strlen(line);
+        }
+        while(isspace(*line)) line ++;
+        if(!*line || *line == '#') continue;
+
+        for(p=line; *p && !isspace(*p); p++);
+        urlw[c] = 1;
+        if(*p) {
+            *p++ = '\0';
+            while(isspace(*p)) p ++;
+            if(isdigit(*p) && atoi(p) > 0) urlw[c] = atoi(p);
+        }
+        urls[c++] = line;
+    }
+
+    free(cfg->urlw);
+    cfg->urls = urls;
+    cfg->urlw = urlw;
+    cfg->urlc = c;
+
+    return 0;
+}
+
+// Vose's alias method: a pick is a uniform slot i, kept with alias_prob[i] or else replaced by alias[i]
+void alias_build(config_t *cfg) {
+    int n = cfg->urlc, *small, *large, s = 0, l = 0, i, j;
+    double *p, sum = 0;
+
+    cfg->alias_prob = p = (double*) malloc(sizeof(double) * n);
+    cfg->alias = (int*) malloc(sizeof(int) * n);
+    small = (int*) malloc(sizeof(int) * n);
+    large = (int*) malloc(sizeof(int) * n);
+
+    for(i=0; i<n; i++) sum += cfg->urlw ? cfg->urlw[i] : 1;
+    for(i=0; i<n; i++) {
+        p[i] = (cfg->urlw ? cfg->urlw[i] : 1) * n / sum;
+        cfg->alias[i] = i;
+        if(p[i] < 1) {
+            small[s++] = i;
+        } else {
+            large[l++] = i;
+        }
+    }
+    while(s && l) {
+        i = small[--s];
+        j = large[l - 1];
+        cfg->alias[i] = j;
+        p[j] -= 1 - p[i];
+        if(p[j] < 1) {
+            l --;
+            small[s++] = j;
+        }
+    }
+    // the rest is 1 up to rounding errors
+    while(s) p[small[--s]] = 1;
+    while(l) p[large[--l]] = 1;
+
+    free(small);
+    free(large);
+}
+
+// URLs take turns, each one -w times in a row, or with --random are picked by weight
+int next_url(const config_t *cfg, idx_t *idx) {
+    int i;
+
+    if(cfg->alias) {
+        double u = erand48(idx->worker->seed) * cfg->urlc;
+
+        i = (int) u;
+        if(i >= cfg->urlc) i = cfg->urlc - 1;
+        return u - i < cfg->alias_prob[i] ? i : cfg->alias[i];
+    }
+
+    // weight
+    if(cfg->urlw) {
+        if(idx->w < cfg->urlw[idx->i]) {
+            i = idx->i;
+            if(++idx->w >= cfg->urlw[idx->i]) {
+                idx->i ++;
+                idx->w = 0;
+            }
+        } else {
+            idx->w = 0;
+            i = idx->i ++;
+        }
+    } else {
+        i = idx->i ++;
+    }
+    if(idx->i >= cfg->urlc) {
+        idx->i = 0;
+    }
+    // printf("  %d => [%d] %s\n", i, cfg->urlw ? cfg->urlw[i] : 1, cfg->urls[i]);
+
+    return i;
+}
+
+volatile bool is_running = true;
+static double timelimit = 0; // -t ends the measured window at this microtime(), 0 until it begins
+static long int begin_reqs = 0;
+static int workers_running = 0;
+static pthread_t main_thread;
+static double begin_time = 0;
+static int capacity_target = 0;
+
+// --warmup, --warmup-requests: results go to the warmup counters until both are over
+static long int warmup_end = 0; // nanotime()
+static long int warmup_left = 0;
+static volatile bool warmed = true;
+static long int measure_begin = 0; // nanotime() the measured window began
+static pthread_barrier_t preconnect_barrier;
+
+// the timing starts here, again after --preconnect
+void measure_start(const config_t *cfg) {
+    struct timespec ts;
+
+    begin_time = microtime();
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wall_offset = ts.tv_sec * 1000000000L + ts.tv_nsec - nanotime();
+
+    warmup_end = nanotime() + (long int) (cfg->warmup * 1000000000);
+    warmup_left = cfg->warmup_requests;
+    // the coordinator sends no requests, its agents warm up by themselves
+    warmed = cfg->coordinator || (cfg->warmup <= 0 && cfg->warmup_requests <= 0);
+    if(warmed) {
+        measure_begin = nanotime();
+        timelimit = begin_time + cfg->timelimit;
+    }
+}
+
+bool warming(const config_t *cfg) {
+    long int now;
+    bool counting;
+
+    if(warmed) return false;
+    now = nanotime();
+    counting = __atomic_sub_fetch(&warmup_left, 1, __ATOMIC_RELAXED) >= 0;
+    if(now < warmup_end || counting) return true;
+
+    // the first measured request begins the -t window
+    if(!__atomic_exchange_n(&warmed, true, __ATOMIC_RELAXED)) {
+        measure_begin = now;
+        timelimit = now / 1000000000.0 + cfg->timelimit;
+    }
+
+    return false;
+}
+
+bool time_over(const config_t *cfg) {
+    return cfg->timelimit > 0 && timelimit > 0 && microtime() > timelimit;
+}
+
+// only the parts that change between requests are set here
+CURL *make_curl(const config_t *cfg, idx_t *idx) {
+    int i;
+    long int seq = 0;
+    const char *url;
+    CURL *curl = idx->curl;
+
+    if(!curl) {
+        curl = idx->curl = curl_easy_duphandle(idx->worker->tmpl);
+
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, idx);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, idx);
+        curl_easy_setopt(curl, CURLOPT_DEBUGDATA, idx);
+        if(cfg->expect_header) curl_easy_setopt(curl, CURLOPT_HEADERDATA, idx);
+        curl_easy_setopt(curl, CURLOPT_PREREQDATA, idx);
+        curl_easy_setopt(curl, CURLOPT_OPENSOCKETDATA, idx);
+        if(cfg->sh) curl_easy_setopt(curl, CURLOPT_SHARE, cfg->sh);
+
+        if(cfg->debug || cfg->verbose) { // set DEBUG or VERBOSE
+            curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+            curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, debug_handler);
+        }
+
+        // set UPLOAD
+        if(cfg->upload_map) {
+            idx->upload.data = cfg->upload_map;
+            idx->upload.size = cfg->upload_size;
+            curl_easy_setopt(curl, CURLOPT_READDATA, &idx->upload);
+            curl_easy_setopt(curl, CURLOPT_SEEKDATA, &idx->upload);
+        }
+
+        // set FORM
+        if(cfg->formc) {
+            idx->mime = make_mime(cfg, curl, idx);
+            curl_easy_setopt(curl, CURLOPT_MIMEPOST, idx->mime);
+        }
+    }
+    idx->upload.pos = 0;
+    // warmup requests do not count against -n
+    idx->warmup = idx->worker->preconnecting || warming(cfg);
+    if(idx->warmup && cfg->requests > 0) __atomic_sub_fetch(&begin_reqs, 1, __ATOMIC_RELAXED);
+    if(cfg->requests_per_conn) curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, (long) cfg->no_reuse);
+    if(cfg->expectc) expect_reset(idx);
+    if(cfg->templated) seq = __atomic_add_fetch(&tmpl_seq, 1, __ATOMIC_RELAXED);
+
+    idx->reqs ++;
+    if(idx->worker->trace.buf) {
+        trace_write(&idx->worker->trace, idx->id, idx->reqs, TRACE_BEGIN, NULL, 0);
+    } else if(idx->logfp) {
+        debug_print(idx->logfp, nowtime(), TRACE_BEGIN, NULL, 0, idx->reqs);
+    }
+
+    // --corpus: the request comes from an entry, in order unless --replay-speed scheduled it
+    if(cfg->corpus) {
+        corpus_entry_t *e;
+
+        if(cfg->replay_speed <= 0) idx->entry = __atomic_fetch_add(&corpus_next, 1, __ATOMIC_RELAXED) % cfg->corpusc;
+        e = &cfg->corpus[idx->entry];
+
+        curl_easy_setopt(curl, CURLOPT_URL, e->url);
+        curl_easy_setopt(curl, CURLOPT_NOBODY, (long) !strcmp(e->method, "HEAD"));
+        if(e->body) {
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) e->body_len);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, e->body);
+        } else if(strcmp(e->method, "HEAD")) {
+            curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+        }
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, strcmp(e->method, e->body ? "POST" : "GET") && strcmp(e->method, "HEAD") ? e->method : NULL);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, e->headers ? e->headers : cfg->header_list);
+        idx->url = idx->entry;
+        url = e->url;
+    } else {
+        i = next_url(cfg, idx);
+        url = cfg->urls[i];
+        if(cfg->url_tmpls && cfg->url_tmpls[i]) {
+            tmpl_render(cfg->url_tmpls[i], idx->tmpl_buf, seq, idx);
+            url = idx->tmpl_buf;
+        }
+
+        // set URL
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        idx->url = i;
+    }
+
+    // set DATA and HEADER templates, the buffers stay with the idx until the request is done
+    if(cfg->data_tmpl) {
+        char *data = idx->tmpl_buf + cfg->data_off;
+
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) tmpl_render(cfg->data_tmpl, data, seq, idx));
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
+    }
+    if(idx->headers) {
+        for(i=0; i<cfg->headerc; i++) {
+            if(cfg->header_tmpls[i]) tmpl_render(cfg->header_tmpls[i], idx->tmpl_buf + cfg->header_offs[i], seq, idx);
+        }
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, idx->headers);
+    }
+
+    // set BODY sink
+    if(cfg->body == BODY_CHECKSUM) {
+        idx->crc = crc32(0L, Z_NULL, 0);
+    } else if(cfg->body == BODY_SAMPLE) {
+        idx->sample = (idx->worker->samples++ % cfg->sample_every == 0);
+        if(idx->sample) {
+            char buf[64];
+
+            idx->sample_len = 0;
+            sample_append(idx, buf, snprintf(buf, sizeof(buf), "\n--- %ld ", idx->worker->samples));
+            sample_append(idx, url, strlen(url));
+            sample_append(idx, "\n", 1);
+        }
+    }
+
+    idx->time = nanotime();
+
+    return curl;
+}
+
+enum {
+    FORM_STRING = 128,
+    TIMEOUT,
+    CONNECT_TIMEOUT,
+    NO_REUSE,
+    SHARE,
+    INSECURE,
+    HTTP2,
+    HTTP2_PRIOR_KNOWLEDGE,
+    MAX_HOST_CONNECTIONS,
+    MAX_STREAMS,
+    PHASES_OPT,
+    BODY,
+    THREADS,
+    RATE,
+    POISSON,
+    DECODE,
+    EPOLL,
+    OUTPUT,
+    REQUEST_LOG,
+    PROFILE,
+    FIND_CAPACITY,
+    CORPUS,
+    REPLAY_SPEED,
+    URL_FILE,
+    RANDOM,
+    SEED,
+    URL_STATS,
+    COORDINATOR,
+    AGENTS,
+    AGENT,
+    SELF_TEST,
+    EXPECT,
+    SATURATION,
+    REQUESTS_PER_CONN,
+    INTERVAL,
+    WARMUP,
+    WARMUP_REQUESTS,
+    PRECONNECT,
+};
+static const char *options = "hViD:vH:Im:d:GF:C:f:saT:k:n:t:c:w:";
+static struct option OPTIONS[] = {
+    {"help",            0, 0, 'h' },
+    {"version",         0, 0, 'V' },
+    {"info",            0, 0, 'i' },
+    {"debug",           1, 0, 'D' },
+
+    {"verbose",         0, 0, 'v' },
+    {"header",          1, 0, 'H' },
+    {"head",            0, 0, 'I'},
+    {"method",          1, 0, 'm' },
+    {"data",            1, 0, 'd' },
+    {"get",             0, 0, 'G' },
+    {"form",            1, 0, 'F' },
+    {"form-string",     1, 0, FORM_STRING },
+    {"cookie",          1, 0, 'C' },
+    {"cookie-file",     1, 0, 'f' },
+    {"cookie-session",  0, 0, 's' },
+    {"append",          0, 0, 'a' },
+    {"upload-file",     1, 0, 'T' },
+    {"keepalive",       1, 0, 'k' },
+    {"timeout",         1, 0, TIMEOUT },
+    {"connect-timeout", 1, 0, CONNECT_TIMEOUT },
+    {"no-reuse",        0, 0, NO_REUSE },
+    {"requests-per-conn", 1, 0, REQUESTS_PER_CONN },
+    {"share",           0, 0, SHARE },
+    {"insecure",        0, 0, INSECURE },
+    {"http2",           0, 0, HTTP2 },
+    {"http2-prior-knowledge", 0, 0, HTTP2_PRIOR_KNOWLEDGE },
+    {"max-host-connections", 1, 0, MAX_HOST_CONNECTIONS },
+    {"max-streams",     1, 0, MAX_STREAMS },
+    {"phases",          0, 0, PHASES_OPT },
+    {"body",            1, 0, BODY },
+    {"epoll",           0, 0, EPOLL },
+
+    {"requests",        1, 0, 'n' },
+    {"timelimit",       1, 0, 't' },
+    {"concurrency",     1, 0, 'c' },
+    {"threads",         1, 0, THREADS },
+    {"warmup",          1, 0, WARMUP },
+    {"warmup-requests", 1, 0, WARMUP_REQUESTS },
+    {"preconnect",      0, 0, PRECONNECT },
+    {"rate",            1, 0, RATE },
+    {"poisson",         0, 0, POISSON },
+    {"profile",         1, 0, PROFILE },
+    {"find-capacity",   1, 0, FIND_CAPACITY },
+    {"coordinator",     1, 0, COORDINATOR },
+    {"agents",          1, 0, AGENTS },
+    {"agent",           1, 0, AGENT },
+    {"decode",          1, 0, DECODE },
+    {"output",          1, 0, OUTPUT },
+    {"interval",        1, 0, INTERVAL },
+    {"request-log",     1, 0, REQUEST_LOG },
+    {"self-test",       1, 0, SELF_TEST },
+    {"expect",          1, 0, EXPECT },
+    {"saturation",      1, 0, SATURATION },
+
+    {"weight",          1, 0, 'w' },
+    {"url-file",        1, 0, URL_FILE },
+    {"random",          0, 0, RANDOM },
+    {"seed",            1, 0, SEED },
+    {"url-stats",       0, 0, URL_STATS },
+    {"corpus",          1, 0, CORPUS },
+    {"replay-speed",    1, 0, REPLAY_SPEED },
+
+    {NULL,              0, 0, 0 }
+};
+
+void usage(char *argv0) {
+    printf(
+        "Usage: %s [options...] <url>...\n"
+        "       %s [options...] --corpus <file>\n"
+        "  -h,--help                         This help\n"
+        "  -V,--version                      Show curl version\n"
+        "  -i,--info                         Show config info\n"
+        "  -D,--debug <path>                 Save debug trace to <path>/.debug.trace\n"
+        "     --decode <trace>               Decode a debug trace into .debug-<idx>.log files, or a request log to CSV\n"
+        "     --output <format>              Report format: text, json (JSON Lines) or csv\n"
+        "     --interval <time>              Time between reports, e.g. 100ms, default 1s\n"
+        "     --request-log <file>           Save a binary record of every request to <file>\n"
+        "     --self-test <spec>             Benchmark against a built-in loopback server, e.g. size=1k,delay=1ms,close=100 or default\n"
+        "     --saturation <limits>          Warn that latencies are suspect above these client limits, default cpu=90%%,lag=10ms\n"
+        "     --expect <check>               Count a request as failed unless status=200[-299], header=<name>[: <value>],\n"
+        "                                    body=<substring>, regex=<pattern>, size=<min>-<max> or json=<path>=<value> holds\n"
+
+        "  -v,--verbose                      Make the operation more talkative\n"
+        "  -H,--header <header>              Set custom request header\n"
+        "  -I,--head                         Show document info only\n"
+        "  -m,--method <method>              Custom request method\n"
+        "  -d,--data <data>                  HTTP POST data\n"
+        "  -G,--get                          Put the post data in the URL and use GET\n"
+        "  -F,--form <name=content>          Specify multipart MIME data\n"
+        "     --form-string <name=string>    Specify multipart MIME data\n"
+        "  -C,--cookie <data|filename>       Send cookies from string/file\n"
+        "  -f,--cookie-file <filename>       Read or write cookies file <filename>\n"
+        "  -s,--cookie-session               Start a new cookie session\n"
+        "  -a,--append                       Append to target file when uploading\n"
+        "  -T,--upload-file <file>           Transfer local FILE to destination\n"
+        "  -k,--keepalive <seconds>          Enable TCP keep-alive\n"
+        "     --timeout <seconds>            Request timeout\n"
+        "     --connect-timeout <seconds>    Connect timeout\n"
+        "     --no-reuse                     New connection and easy handle for every request\n"
+        "     --requests-per-conn <num>      Close every HTTP/1.1 connection after <num> requests\n"
+        "     --share                        Share DNS cache and TLS sessions between all handles\n"
+        "     --insecure                     Allow insecure TLS connections\n"
+        "     --http2                        Use HTTP/2, concurrent requests are multiplexed as streams\n"
+        "     --http2-prior-knowledge        Use HTTP/2 without HTTP/1.1 Upgrade\n"
+        "     --max-host-connections <num>   Max connections per host for each thread\n"
+        "     --max-streams <num>            Max concurrent streams per HTTP/2 connection\n"
+        "     --phases                       Show DNS, connect, TLS, TTFB and transfer times\n"
+        "     --body <sink>                  Response bodies: discard, stderr, checksum or sample:<n>:<file>\n"
+        "     --epoll                        Event loop on epoll and curl_multi_socket_action, for very high concurrency\n"
+
+        "  -n,--requests <requests>          Number of requests to perform\n"
+        "  -t,--timelimit <seconds>          Seconds to max. to spend on benchmarking\n"
+        "  -c,--concurrency <concurrency>    Number of multiple requests to make at a time\n"
+        "     --threads <threads>            Number of worker threads, each with its own multi handle\n"
+        "     --warmup <time>                Count requests of the first <time>, e.g. 5s, apart and start -t after them\n"
+        "     --warmup-requests <num>        Count the first <num> requests apart, -n requests are measured after them\n"
+        "     --preconnect                   Open every connection with one warmup request before timing starts\n"
+        "     --rate <reqs>                  Open-loop: send <reqs> requests per second, -c caps requests in flight\n"
+        "     --poisson                      Poisson-distributed arrival times for --rate\n"
+        "     --profile <stages>             Concurrency schedule, e.g. 0-500@60s,500@300s,500-2000@30s\n"
+        "     --find-capacity <slo>          Search the highest concurrency up to -c that meets the SLO, e.g. p99<200ms,err<0.1%%,hold=5s\n"
+        "     --coordinator <[host:]port>    Split the load between --agents agents and report their merged stats\n"
+        "     --agents <num>                 Number of agents to wait for\n"
+        "     --agent <host:port>            Run the load the coordinator at <host:port> hands out\n"
+
+        "  -w,--weight <weight>              URL weights\n"
+        "     --url-file <file>              Read more URLs from <file>, one \"<url> [weight]\" per line\n"
+        "     --random                       Pick URLs at random by weight instead of in turns\n"
+        "     --seed <seed>                  Seed of --random and --poisson, for reproducible runs\n"
+        "     --url-stats                    Show codes, rate and latency of every URL in the summary\n"
+        "     --corpus <file>                Replay the requests of <file> instead of <url>s, in order\n"
+        "     --replay-speed <factor>        Send --corpus requests at their original times, <factor> times faster\n"
+        "\n"
+        "<url>s, -H and -d may contain {{seq}}, {{rand:<min>-<max>}}, {{uuid}}, {{line:<file>}} and {{idx}}\n"
+        , argv0, argv0
+    );
+}
+
+// --profile: "0-500@60s,500@300s", a stage ramps from-to or holds a concurrency for a duration
+int parse_profile(config_t *cfg, char *arg) {
+    char *p = arg, *end;
+    double unit;
+
+    cfg->stagec = 0;
+    while(*p) {
+        if(cfg->stagec >= sizeof(cfg->stages)/sizeof(cfg->stages[0])) return -1;
+
+        cfg->stages[cfg->stagec].from = cfg->stages[cfg->stagec].to = strtol(p, &end, 10);
+        if(end == p || cfg->stages[cfg->stagec].from < 0) return -1;
+        p = end;
+        if(*p == '-') {
+            cfg->stages[cfg->stagec].to = strtol(++p, &end, 10);
+            if(end == p || cfg->stages[cfg->stagec].to < 0) return -1;
+            p = end;
+        }
+        if(*p++ != '@') return -1;
+
+        cfg->stages[cfg->stagec].seconds = strtod(p, &end);
+        if(end == p || cfg->stages[cfg->stagec].seconds <= 0) return -1;
+        p = end;
+        if(!strncmp(p, "ms", 2)) {
+            unit = 0.001;
+            p += 2;
+        } else if(*p == 's' || *p == 'm' || *p == 'h') {
+            unit = (*p == 's' ? 1 : (*p == 'm' ? 60 : 3600));
+            p ++;
+        } else {
+            unit = 1;
+        }
+        cfg->stages[cfg->stagec++].seconds *= unit;
+
+        if(*p == ',') {
+            p ++;
+        } else if(*p) {
+            return -1;
+        }
+    }
+
+    return cfg->stagec ? 0 : -1;
+}
+
+// --find-capacity: "p99<200ms,err<0.1%", optionally "hold=10s" for the seconds spent on each level
+int parse_capacity(config_t *cfg, char *arg) {
+    char *p = arg, *end;
+    double v;
+    int i;
+
+    cfg->capacity = true;
+    cfg->sloc = 0;
+    cfg->slo_err = -1;
+    cfg->hold = 5;
+    while(*p) {
+        if(!strncmp(p, "err<", 4)) {
+            v = strtod(p + 4, &end);
+            if(end == p + 4 || v < 0) return -1;
+            p = end;
+            if(*p == '%') {
+                v /= 100;
+                p ++;
+            }
+            cfg->slo_err = v;
+        } else if(!strncmp(p, "hold=", 5)) {
+            v = strtod(p + 5, &end);
+            if(end == p + 5 || v <= 0) return -1;
+            p = end;
+            if(*p == 's') p ++;
+            cfg->hold = v;
+        } else {
+            for(i=0; i<HIST_STATS; i++) {
+                if(!strncmp(p, stat_names[i], strlen(stat_names[i])) && p[strlen(stat_names[i])] == '<') break;
+            }
+            if(i >= HIST_STATS || cfg->sloc >= sizeof(cfg->slos)/sizeof(cfg->slos[0])) return -1;
+            p += strlen(stat_names[i]) + 1;
+
+            v = strtod(p, &end);
+            if(end == p || v <= 0) return -1;
+            p = end;
+            if(!strncmp(p, "us", 2)) {
+                p += 2;
+            } else if(!strncmp(p, "ms", 2)) {
+                v *= 1000;
+                p += 2;
+            } else if(*p == 's') {
+                v *= 1000000;
+                p ++;
+            } else {
+                v *= 1000; // milliseconds like the reports
+            }
+            cfg->slos[cfg->sloc].stat = i;
+            cfg->slos[cfg->sloc++].max = (long int) v;
+        }
+
+        if(*p == ',') {
+            p ++;
+        } else if(*p) {
+            return -1;
+        }
+    }
+
+    return cfg->sloc || cfg->slo_err >= 0 ? 0 : -1;
+}
+
+// --self-test: "size=1k,delay=1ms,close=100", or "default" for a 64 bytes body right away on kept-alive connections
+int parse_self_test(config_t *cfg, char *arg) {
+    char *p = arg, *end;
+    double v;
+
+    cfg->self_test = true;
+    cfg->server.size = 64;
+    cfg->server.delay = 0;
+    cfg->server.close = 0;
+    if(!strcmp(arg, "default")) return 0;
+    while(*p) {
+        if(!strncmp(p, "size=", 5)) {
+            v = strtod(p + 5, &end);
+            if(end == p + 5 || v < 0) return -1;
+            p = end;
+            if(*p == 'k' || *p == 'K') {
+                v *= 1024;
+                p ++;
+            } else if(*p == 'm' || *p == 'M') {
+                v *= 1024 * 1024;
+                p ++;
+            }
+            cfg->server.size = (long int) v;
+        } else if(!strncmp(p, "delay=", 6)) {
+            v = strtod(p + 6, &end);
+            if(end == p + 6 || v < 0) return -1;
+            p = end;
+            if(!strncmp(p, "us", 2)) {
+                v /= 1000000;
+                p += 2;
+            } else if(!strncmp(p, "ms", 2)) {
+                v /= 1000;
+                p += 2;
+            } else if(*p == 's') {
+                p ++;
+            } else {
+                v /= 1000; // milliseconds like the reports
+            }
+            cfg->server.delay = v;
+        } else if(!strncmp(p, "close=", 6)) {
+            cfg->server.close = strtol(p + 6, &end, 10);
+            if(end == p + 6 || cfg->server.close < 0) return -1;
+            p = end;
+        } else {
+            return -1;
+        }
+
+        if(*p == ',') {
+            p ++;
+        } else if(*p) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// --saturation: "cpu=90%,lag=10ms", CPU share of the usable cores and p99 event loop lag
+int parse_saturation(config_t *cfg, char *arg) {
+    char *p = arg, *end;
+    double v;
+
+    while(*p) {
+        if(!strncmp(p, "cpu=", 4)) {
+            v = strtod(p + 4, &end);
+            if(end == p + 4 || v <= 0) return -1;
+            p = end;
+            if(*p == '%') p ++;
+            cfg->sat_cpu = v / 100;
+        } else if(!strncmp(p, "lag=", 4)) {
+            v = strtod(p + 4, &end);
+            if(end == p + 4 || v <= 0) return -1;
+            p = end;
+            if(!strncmp(p, "us", 2)) {
+                v /= 1000;
+                p += 2;
+            } else if(!strncmp(p, "ms", 2)) {
+                p += 2;
+            } else if(*p == 's') {
+                v *= 1000;
+                p ++;
+            }
+            cfg->sat_lag = (long int) (v * 1000);
+        } else {
+            return -1;
+        }
+
+        if(*p == ',') {
+            p ++;
+        } else if(*p) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// --expect: "status=200", "status=200-299", "header=Name[: value]", "body=<substring>", "regex=<pattern>", "size=<min>-<max>" or "json=<path>=<value>"
+int parse_expect(config_t *cfg, char *arg) {
+    expect_t *e;
+    char *p, *end;
+
+    if(cfg->expectc >= EXPECT_MAX) return -1;
+    e = &cfg->expects[cfg->expectc];
+    memset(e, 0, sizeof(*e));
+    e->arg = arg;
+
+    if(!strncmp(arg, "status=", 7)) {
+        e->type = EXPECT_STATUS;
+        e->min = e->max = strtol(arg + 7, &end, 10);
+        if(end == arg + 7) return -1;
+        if(*end == '-') {
+            p = end + 1;
+            e->max = strtol(p, &end, 10);
+            if(end == p || e->max < e->min) return -1;
+        }
+        if(*end) return -1;
+    } else if(!strncmp(arg, "header=", 7)) {
+        e->type = EXPECT_HEADER;
+        e->name = arg + 7;
+        p = strchr(e->name, ':');
+        e->name_len = p ? (size_t) (p - e->name) : strlen(e->name);
+        if(!e->name_len) return -1;
+        if(p) {
+            for(p++; *p == ' '; p++);
+            e->value = p;
+            e->value_len = strlen(p);
+        }
+        cfg->expect_header = true;
+    } else if(!strncmp(arg, "body=", 5)) {
+        e->type = EXPECT_BODY;
+        e->value = arg + 5;
+        e->value_len = strlen(e->value);
+        if(!e->value_len || e->value_len > EXPECT_NEEDLE) return -1;
+    } else if(!strncmp(arg, "regex=", 6)) {
+        e->type = EXPECT_REGEX;
+        if(regcomp(&e->re, arg + 6, REG_EXTENDED | REG_NOSUB)) return -1;
+        cfg->expect_buffer = true;
+    } else if(!strncmp(arg, "size=", 5)) {
+        e->type = EXPECT_SIZE;
+        p = arg + 5;
+        e->min = strtol(p, &end, 10);
+        e->max = -1;
+        if(*end != '-') {
+            if(end == p || *end) return -1;
+            e->max = e->min;
+        } else if(end[1]) {
+            p = end + 1;
+            e->max = strtol(p, &end, 10);
+            if(end == p || *end || e->max < e->min) return -1;
+        }
+        if(e->min < 0) return -1;
+    } else if(!strncmp(arg, "json=", 5)) {
+        e->type = EXPECT_JSON;
+        e->name = arg + 5;
+        p = strchr(e->name, '=');
+        if(!p || p == e->name) return -1;
+        e->name_len = p - e->name;
+        e->value = p + 1;
+        e->value_len = strlen(e->value);
+        cfg->expect_buffer = true;
+    } else {
+        return -1;
+    }
+
+    cfg->expectc ++;
+    return 0;
+}
+
+// target concurrency of the profile at elapsed seconds
+int profile_target(const config_t *cfg, double elapsed) {
+    int i;
+
+    for(i=0; i<cfg->stagec; i++) {
+        if(elapsed < cfg->stages[i].seconds) {
+            return (int) floor(cfg->stages[i].from + (cfg->stages[i].to - cfg->stages[i].from) * elapsed / cfg->stages[i].seconds + 0.5);
+        }
+        elapsed -= cfg->stages[i].seconds;
+    }
+
+    return cfg->stagec ? cfg->stages[cfg->stagec - 1].to : 0;
+}
+
+// open-loop: start every arrival that is due, returns milliseconds to wait for the next one
+int worker_schedule(worker_t *w) {
+    const config_t *cfg = w->cfg;
+    stats_t *stats = &w->stats;
+    double now = microtime(), intended;
+    idx_t *idx;
+
+    while(w->scheduling && w->next_time <= now) {
+        if(!is_running || time_over(cfg) || (cfg->replay_speed > 0 && w->replay_entry >= cfg->corpusc) || (cfg->requests > 0 && __atomic_fetch_add(&begin_reqs, 1, __ATOMIC_RELAXED) >= cfg->requests)) {
+            w->scheduling = false;
+            break;
+        }
+
+        if(w->backlogc >= w->idxc) {
+            STAT_ADD(stats->dropped, 1);
+        } else {
+            if(w->backlogc >= w->idlec) STAT_ADD(stats->late, 1);
+            w->backlog[(w->backlogi + w->backlogc) % w->idxc].time = w->next_time;
+            w->backlog[(w->backlogi + w->backlogc++) % w->idxc].entry = w->replay_entry;
+        }
+
+        // --replay-speed: the workers take turns on the corpus entries, each at its original time
+        if(cfg->replay_speed > 0) {
+            w->replay_entry += cfg->threads;
+            if(w->replay_entry < cfg->corpusc) w->next_time = begin_time + (cfg->corpus[w->replay_entry].time - cfg->corpus[0].time) / cfg->replay_speed;
+        } else {
+            w->next_time += (cfg->poisson ? -log(1.0 - erand48(w->seed)) : 1.0) / w->rate;
+        }
+    }
+
+    while(w->backlogc && w->idlec) {
+        intended = w->backlog[w->backlogi].time;
+        idx = w->idle[--w->idlec];
+        idx->entry = w->backlog[w->backlogi].entry;
+        w->backlogi = (w->backlogi + 1) % w->idxc;
+        w->backlogc --;
+
+        curl_multi_add_handle(w->multi, make_curl(cfg, idx));
+        idx->time = (long int) (intended * 1000000000); // latency counts from the intended send time
+        STAT_ADD(stats->concurrency, 1);
+    }
+
+    if(!w->scheduling || w->backlogc) return 1000;
+    if(w->next_time <= now) return 0;
+    return (int) ceil((w->next_time - now) * 1000);
+}
+
+// --profile: bring the idxs in flight up to the share of the target of this worker, returns milliseconds to the next check
+int worker_profile(worker_t *w) {
+    const config_t *cfg = w->cfg;
+    stats_t *stats = &w->stats;
+    int target = cfg->capacity ? STAT_GET(capacity_target) : profile_target(cfg, microtime() - begin_time);
+    idx_t *idx;
+
+    w->target = (long int) target * (w->id + 1) / cfg->threads - (long int) target * w->id / cfg->threads;
+    STAT_SET(stats->target, w->target);
+
+    while(w->profiling && stats->concurrency < w->target && w->idlec) {
+        if(!is_running || time_over(cfg) || (cfg->requests > 0 && __atomic_fetch_add(&begin_reqs, 1, __ATOMIC_RELAXED) >= cfg->requests)) {
+            w->profiling = false;
+            break;
+        }
+
+        idx = w->idle[--w->idlec];
+        curl_multi_add_handle(w->multi, make_curl(cfg, idx));
+        STAT_ADD(stats->concurrency, 1);
+    }
+    if(w->profiling && (!is_running || time_over(cfg) || (cfg->requests > 0 && STAT_GET(begin_reqs) >= cfg->requests))) w->profiling = false;
+
+    // ramps move the target continuously, follow it 10 times per second
+    return 100;
+}
+
+// a transfer is finished: account it, then reuse the idx for the next request or retire it
+void worker_done(worker_t *w, CURL *curl) {
+    const config_t *cfg = w->cfg;
+    stats_t *stats = &w->stats;
+    idx_t *idx = NULL;
+    long code = 0, latency, req_bytes, res_bytes, phases[PHASES] = {0};
+    bool failed;
+    int i;
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, &idx);
+    if(idx->warmup) stats = &w->warmup;
+
+    {
+        long header_size = 0, request_size = 0;
+        curl_off_t upload = 0, download = 0;
+
+        curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE, &request_size);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &upload);
+        curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &header_size);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &download);
+        // POSTFIELDS bodies are in the request size already, -T and -F bodies are sent by their read callbacks
+        req_bytes = request_size + (cfg->upload_map || cfg->formc ? upload : 0);
+        res_bytes = header_size + download;
+        STAT_ADD(stats->req_bytes, req_bytes);
+        STAT_ADD(stats->res_bytes, res_bytes);
+    }
+
+    // a new TLS connection means a handshake, full or resumed
+    if(idx->tls_conn) {
+        long connects = 0;
+
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+        if(connects > 0) {
+            STAT_ADD(stats->handshakes, 1);
+            if(idx->tls_resumed) STAT_ADD(stats->resumed, 1);
+        }
+        idx->tls_conn = false;
+    }
+    if(idx->stream) {
+        STAT_ADD(w->stats.streams, -1);
+        idx->stream = false;
+    }
+
+    if(cfg->phases || w->request_buf) {
+        curl_off_t dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+
+        // libcurl reports times since the start of the transfer, a phase is the difference
+        if(connect < dns) connect = dns;
+        if(tls < connect) tls = connect;
+        if(ttfb < tls) ttfb = tls;
+        if(total < ttfb) total = ttfb;
+        phases[PHASE_DNS] = dns;
+        phases[PHASE_CONNECT] = connect - dns;
+        phases[PHASE_TLS] = tls - connect;
+        phases[PHASE_TTFB] = ttfb - tls;
+        phases[PHASE_TRANSFER] = total - ttfb;
+        if(cfg->phases) {
+            for(i=0; i<PHASES; i++) hist_record(&stats->phases[i], phases[i]);
+        }
+    }
+
+    // keep the easy handle, libcurl's connection cache decides whether the connection is reused
+    curl_multi_remove_handle(w->multi, curl);
+    if(cfg->no_reuse) idx_cleanup(idx);
+    curl = NULL;
+
+    // concurrent sampled bodies are written one after another, not interleaved
+    if(idx->sample) {
+        body_write(w, idx->sample_buf, idx->sample_len);
+        idx->sample = false;
+    }
+
+    // the first 2xx body of an URL is the reference for all later ones
+    if(cfg->body == BODY_CHECKSUM && code >= 200 && code < 300) {
+        unsigned long int sum = idx->crc | (1UL << 32), expected = 0;
+
+        if(!__atomic_compare_exchange_n(&cfg->checksums[idx->url], &expected, sum, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) && expected != sum) {
+            STAT_ADD(stats->mismatches, 1);
+        }
+    }
+
+    if(code < 100) {
+        STAT_ADD(stats->code0xx, 1);
+    } else if(code < 200) {
+        STAT_ADD(stats->code1xx, 1);
+    } else if(code < 300) {
+        STAT_ADD(stats->code2xx, 1);
+    } else if(code < 400) {
+        STAT_ADD(stats->code3xx, 1);
+    } else if(code < 500) {
+        STAT_ADD(stats->code4xx, 1);
+    } else if(code < 600) {
+        STAT_ADD(stats->code5xx, 1);
+    } else {
+        STAT_ADD(stats->codex, 1);
+    }
+
+    failed = cfg->expectc && expect_check(cfg, idx, code, stats);
+    if(failed) STAT_ADD(stats->failures, 1);
+
+    latency = (nanotime() - idx->time) / 1000;
+    hist_record(&stats->latency, latency);
+    __atomic_store_n(&stats->end_reqs, stats->end_reqs + 1, __ATOMIC_RELEASE);
+
+    if(w->url_stats && !idx->warmup) {
+        url_stats_t *u = w->url_stats[idx->url];
+
+        if(!u) u = w->url_stats[idx->url] = (url_stats_t*) calloc(1, sizeof(url_stats_t));
+        u->reqs ++;
+        u->req_bytes += req_bytes;
+        u->res_bytes += res_bytes;
+        u->failures += failed;
+        u->codes[code < 600 ? code / 100 : 6] ++;
+        hist_record(&u->latency, latency);
+    }
+
+    if(w->request_buf && !idx->warmup) {
+        request_record_t r;
+
+        r.time = (idx->time + wall_offset) / 1000;
+        r.req_bytes = req_bytes;
+        r.res_bytes = res_bytes;
+        r.latency = latency;
+        for(i=0; i<PHASES; i++) r.phases[i] = phases[i];
+        r.idx = idx->id;
+        r.reqs = idx->reqs;
+        r.url = idx->url;
+        r.code = code;
+        request_write(w, &r);
+    }
+
+    if(w->trace.buf || idx->logfp) {
+        double elapsed = (nanotime() - idx->time) / 1000000000.0;
+
+        if(w->trace.buf) {
+            trace_write(&w->trace, idx->id, idx->reqs, TRACE_END, &elapsed, sizeof(elapsed));
+        } else {
+            debug_print(idx->logfp, nowtime(), TRACE_END, (const char*) &elapsed, sizeof(elapsed), idx->reqs);
+        }
+    }
+
+    // -n and -t are shared by all workers, --preconnect keeps the handle for the measured run
+    stats = &w->stats;
+    if(w->preconnecting) {
+        return;
+    } else if(w->scheduling || w->backlogc || (w->profiling && stats->concurrency > w->target)) {
+        STAT_ADD(stats->concurrency, -1);
+        w->idle[w->idlec++] = idx;
+    } else if((!w->idle || w->profiling) && is_running && !time_over(cfg) && (cfg->requests <= 0 || __atomic_fetch_add(&begin_reqs, 1, __ATOMIC_RELAXED) < cfg->requests)) {
+        curl_multi_add_handle(w->multi, make_curl(cfg, idx));
+    } else {
+        STAT_ADD(stats->concurrency, -1);
+        idx_cleanup(idx);
+    }
+}
+
+void worker_read(worker_t *w) {
+    struct CURLMsg *m;
+    int msgs;
+
+    while((m = curl_multi_info_read(w->multi, &msgs))) {
+        if(m->msg == CURLMSG_DONE) worker_done(w, m->easy_handle);
+    }
+}
+
+// --epoll: libcurl tells which sockets to watch, so a wakeup costs the ready sockets only
+int socket_callback(CURL *curl, curl_socket_t s, int what, void *userp, void *socketp) {
+    worker_t *w = (worker_t*) userp;
+    struct epoll_event ev;
+
+    if(what == CURL_POLL_REMOVE) {
+        epoll_ctl(w->epfd, EPOLL_CTL_DEL, s, NULL);
+        return 0;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (what & CURL_POLL_IN ? EPOLLIN : 0) | (what & CURL_POLL_OUT ? EPOLLOUT : 0);
+    ev.data.fd = s;
+    if(socketp) {
+        epoll_ctl(w->epfd, EPOLL_CTL_MOD, s, &ev);
+    } else {
+        if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, s, &ev) && errno == EEXIST) epoll_ctl(w->epfd, EPOLL_CTL_MOD, s, &ev);
+        curl_multi_assign(w->multi, s, w);
+    }
+
+    return 0;
+}
+
+int timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+    worker_t *w = (worker_t*) userp;
+
+    w->timer = (timeout_ms < 0 ? 0 : microtime() + timeout_ms / 1000.0);
+
+    return 0;
+}
+
+void worker_wakeup(worker_t *w) {
+    if(w->cfg->epoll) {
+        eventfd_write(w->wakefd, 1);
+    } else {
+        curl_multi_wakeup(w->multi);
+    }
+}
+
+#define EPOLL_EVENTS 1024
+
+void worker_epoll(worker_t *w) {
+    stats_t *stats = &w->stats;
+    struct epoll_event events[EPOLL_EVENTS];
+    eventfd_t value;
+    CURLMcode mc = CURLM_OK;
+    int i, n, mask, running, timeout, wait;
+    long int woke = 0;
+    double now;
+
+    curl_multi_socket_action(w->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    worker_read(w);
+
+    do {
+        timeout = 1000;
+        if(w->scheduling || w->backlogc) {
+            timeout = worker_schedule(w);
+            if(!stats->concurrency && !w->scheduling && !w->backlogc) break;
+        } else if(w->profiling) {
+            timeout = worker_profile(w);
+            if(!stats->concurrency && !w->profiling) break;
+        }
+        if(w->timer > 0) {
+            now = microtime();
+            wait = (w->timer <= now ? 0 : (int) ceil((w->timer - now) * 1000));
+            if(wait < timeout) timeout = wait;
+        }
+
+        if(woke > 0) hist_record(&stats->loop_lag, (nanotime() - woke) / 1000);
+        STAT_ADD(stats->loops, 1);
+        n = epoll_wait(w->epfd, events, EPOLL_EVENTS, timeout);
+        woke = nanotime();
+        if(n < 0 && errno != EINTR) {
+            fprintf(stderr, "epoll_wait error: %s\n", strerror(errno));
+            break;
+        }
+
+        for(i=0; i<n && !mc; i++) {
+            if(events[i].data.fd == w->wakefd) {
+                eventfd_read(w->wakefd, &value);
+                continue;
+            }
+            mask = (events[i].events & EPOLLIN ? CURL_CSELECT_IN : 0) | (events[i].events & EPOLLOUT ? CURL_CSELECT_OUT : 0) | (events[i].events & (EPOLLERR | EPOLLHUP) ? CURL_CSELECT_ERR : 0);
+            mc = curl_multi_socket_action(w->multi, events[i].data.fd, mask, &running);
+        }
+        if(!mc && w->timer > 0 && w->timer <= microtime()) {
+            w->timer = 0;
+            mc = curl_multi_socket_action(w->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+        if(mc) {
+            fprintf(stderr, "curl_multi_socket_action error: %s\n", curl_multi_strerror(mc));
+            break;
+        }
+
+        worker_read(w);
+    } while(stats->concurrency || w->scheduling || w->backlogc || w->profiling);
+}
+
+void *worker_run(void *arg) {
+    worker_t *w = (worker_t*) arg;
+    const config_t *cfg = w->cfg;
+    stats_t *stats = &w->stats;
+    int still_running;
+    CURLMcode mc;
+    idx_t *idx;
+    int c, timeout = 1000;
+    long int woke;
+
+    // arrivals and URL picks of a worker repeat with the same --seed
+    w->seed[0] = w->id;
+    w->seed[1] = cfg->seed >= 0 ? cfg->seed : getpid();
+    w->seed[2] = cfg->seed >= 0 ? cfg->seed >> 16 : time(NULL);
+
+    // --preconnect: every idx sends one warmup request, then the timing starts with the connections open
+    if(cfg->preconnect) {
+        w->preconnecting = true;
+        for(c=0; c<w->idxc; c++) {
+            if(cfg->requests > 0) __atomic_add_fetch(&begin_reqs, 1, __ATOMIC_RELAXED);
+            curl_multi_add_handle(w->multi, make_curl(cfg, &w->idxs[c]));
+        }
+        do {
+            still_running = 0;
+            if(curl_multi_perform(w->multi, &still_running)) break;
+            worker_read(w);
+            if(still_running) curl_multi_poll(w->multi, NULL, 0, 1000, NULL);
+        } while(still_running);
+        w->preconnecting = false;
+        pthread_barrier_wait(&preconnect_barrier); // main thread starts the timing meanwhile
+        pthread_barrier_wait(&preconnect_barrier);
+    }
+
+    if(cfg->replay_speed > 0) {
+        w->scheduling = true;
+        w->replay_entry = w->id;
+        w->next_time = begin_time + (w->replay_entry < cfg->corpusc ? (cfg->corpus[w->replay_entry].time - cfg->corpus[0].time) / cfg->replay_speed : 0);
+    } else if(cfg->rate > 0) {
+        w->scheduling = true;
+        w->rate = cfg->rate / cfg->threads;
+        w->next_time = microtime() + w->id / cfg->rate;
+    }
+    if(w->scheduling) {
+        w->idle = (idx_t**) malloc(sizeof(idx_t*) * w->idxc);
+        w->backlog = (arrival_t*) malloc(sizeof(arrival_t) * w->idxc);
+        for(c=0; c<w->idxc; c++) {
+            w->idle[w->idlec++] = &w->idxs[w->idxc - c - 1];
+        }
+    } else if(cfg->stagec || cfg->capacity) {
+        w->profiling = true;
+        w->idle = (idx_t**) malloc(sizeof(idx_t*) * w->idxc);
+        for(c=0; c<w->idxc; c++) {
+            w->idle[w->idlec++] = &w->idxs[w->idxc - c - 1];
+        }
+    } else {
+        for(c=0; c<w->idxc; c++) {
+            curl_multi_add_handle(w->multi, make_curl(cfg, &w->idxs[c]));
+        }
+    }
+
+    if(cfg->epoll) {
+        worker_epoll(w);
+    } else do {
+        woke = nanotime();
+        still_running = 0;
+        mc = curl_multi_perform(w->multi, &still_running);
+
+        if(mc) {
+            fprintf(stderr, "curl_multi_perform error: %s\n", curl_multi_strerror(mc));
+            break;
+        }
+
+        worker_read(w);
+
+        if(w->scheduling || w->backlogc) {
+            timeout = worker_schedule(w);
+        } else if(w->profiling) {
+            timeout = worker_profile(w);
+        }
+        hist_record(&stats->loop_lag, (nanotime() - woke) / 1000);
+        STAT_ADD(stats->loops, 1);
+
+        if(still_running || w->scheduling || w->backlogc || w->profiling) {
+            mc = curl_multi_poll(w->multi, NULL, 0, timeout, NULL);
+            if(mc) {
+                fprintf(stderr, "curl_multi_poll error: %s\n", curl_multi_strerror(mc));
+                break;
+            }
+        }
+    } while(stats->concurrency || w->scheduling || w->backlogc || w->profiling);
+
+    while(w->idlec) {
+        idx = w->idle[--w->idlec];
+        idx_cleanup(idx);
+    }
+    free(w->idle);
+    free(w->backlog);
+
+    // kept-alive connections are closed by curl_multi_cleanup after the summary, account them as they are now
+    for(c=0; c<w->connc; c++) {
+        if(w->conns[c].reqs) conn_close(w, c);
+    }
+
+    if(w->body_buf) {
+        body_flush(w);
+        free(w->body_buf);
+        if(w->body_fd != STDERR_FILENO) close(w->body_fd);
+    }
+    if(w->request_buf) {
+        write_all(cfg->request_log_fd, w->request_buf, w->request_len);
+        free(w->request_buf);
+    }
+
+    // the last worker wakes up main thread for the final report
+    if(__atomic_sub_fetch(&workers_running, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_kill(main_thread, SIGALRM);
+    }
+
+    return NULL;
+}
+
+// add up a snapshot of the counters of a worker, which keeps writing them meanwhile
+void stats_merge(stats_t *dst, const stats_t *src, bool phases) {
+    int i;
+
+    dst->end_reqs += __atomic_load_n(&src->end_reqs, __ATOMIC_ACQUIRE);
+    dst->concurrency += STAT_GET(src->concurrency);
+    dst->keepalives += STAT_GET(src->keepalives);
+    dst->target += STAT_GET(src->target);
+    dst->connections += STAT_GET(src->connections);
+    dst->streams += STAT_GET(src->streams);
+    dst->code0xx += STAT_GET(src->code0xx);
+    dst->code1xx += STAT_GET(src->code1xx);
+    dst->code2xx += STAT_GET(src->code2xx);
+    dst->code3xx += STAT_GET(src->code3xx);
+    dst->code4xx += STAT_GET(src->code4xx);
+    dst->code5xx += STAT_GET(src->code5xx);
+    dst->codex += STAT_GET(src->codex);
+    dst->req_bytes += STAT_GET(src->req_bytes);
+    dst->res_bytes += STAT_GET(src->res_bytes);
+    dst->bug_bytes += STAT_GET(src->bug_bytes);
+    dst->late += STAT_GET(src->late);
+    dst->dropped += STAT_GET(src->dropped);
+    dst->handshakes += STAT_GET(src->handshakes);
+    dst->resumed += STAT_GET(src->resumed);
+    dst->mismatches += STAT_GET(src->mismatches);
+    dst->failures += STAT_GET(src->failures);
+    for(i=0; i<EXPECT_MAX; i++) dst->expect_fails[i] += STAT_GET(src->expect_fails[i]);
+
+    dst->loops += STAT_GET(src->loops);
+    dst->new_conns += STAT_GET(src->new_conns);
+    dst->reused_conns += STAT_GET(src->reused_conns);
+
+    hist_merge(&dst->latency, &src->latency);
+    hist_merge(&dst->loop_lag, &src->loop_lag);
+    hist_merge(&dst->conn_reqs, &src->conn_reqs);
+    hist_merge(&dst->conn_life, &src->conn_life);
+    if(phases) {
+        for(i=0; i<PHASES; i++) hist_merge(&dst->phases[i], &src->phases[i]);
+    }
+}
+
+// --self-test: a minimal HTTP/1.1 responder on loopback, in its own thread, so that the client's own ceiling shows
+#define SERVER_BUFSIZE 4096
+
+typedef struct {
+    int fd;
+    char in[SERVER_BUFSIZE];
+    int inlen;
+    long int skip; // request body bytes still to be read and dropped
+    int responses; // sent on this connection
+    int outq;      // due responses not written yet
+    size_t outpos; // of the response being written
+    int queued;    // requests waiting for --self-test delay, the conn is freed when it is closed and none wait
+    bool writing;
+} server_conn_t;
+
+// all responses have the same delay, so they become due in the order the requests came in
+typedef struct {
+    double due;
+    server_conn_t *conn;
+} server_due_t;
+
+static struct {
+    int lfd, epfd;
+    pthread_t tid;
+    volatile bool running;
+    char url[64];
+    char *resp, *resp_close; // header and body, the second one with Connection: close
+    size_t resp_len, resp_close_len;
+    server_due_t *dues;
+    int duei, duec, duesize;
+    long int conns, max_conns;
+    long int base_rss; // bytes, before the workers start
+} server;
+
+static void server_close(server_conn_t *conn) {
+    close(conn->fd);
+    conn->fd = -1;
+    server.conns --;
+    if(!conn->queued) free(conn);
+}
+
+// writes the due responses, false when the connection was closed
+static bool server_flush(const config_t *cfg, server_conn_t *conn) {
+    struct epoll_event ev;
+    const char *resp;
+    size_t len;
+    ssize_t n;
+    bool last;
+
+    while(conn->outq) {
+        last = (cfg->server.close > 0 && conn->responses + 1 >= cfg->server.close);
+        resp = last ? server.resp_close : server.resp;
+        len = last ? server.resp_close_len : server.resp_len;
+
+        n = write(conn->fd, resp + conn->outpos, len - conn->outpos);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && errno == EAGAIN) break;
+        if(n <= 0) {
+            server_close(conn);
+            return false;
+        }
+        conn->outpos += n;
+        if(conn->outpos < len) continue;
+
+        conn->outpos = 0;
+        conn->outq --;
+        conn->responses ++;
+        if(last) {
+            server_close(conn);
+            return false;
+        }
+    }
+
+    // wait for room only while something is left to write
+    if(conn->writing != (conn->outq > 0)) {
+        conn->writing = (conn->outq > 0);
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | (conn->writing ? EPOLLOUT : 0);
+        ev.data.ptr = conn;
+        epoll_ctl(server.epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+    }
+
+    return true;
+}
+
+static void server_due(const config_t *cfg, server_conn_t *conn) {
+    if(cfg->server.delay <= 0) {
+        conn->outq ++;
+        return;
+    }
+    if(server.duec >= server.duesize) {
+        server_due_t *dues = (server_due_t*) malloc(sizeof(server_due_t) * server.duesize * 2);
+        int i;
+
+        for(i=0; i<server.duec; i++) dues[i] = server.dues[(server.duei + i) % server.duesize];
+        free(server.dues);
+        server.dues = dues;
+        server.duei = 0;
+        server.duesize *= 2;
+    }
+    server.dues[(server.duei + server.duec++) % server.duesize] = (server_due_t) {microtime() + cfg->server.delay, conn};
+    conn->queued ++;
+}
+
+// every complete request in the buffer gets a response, bodies go by Content-Length
+static bool server_read(const config_t *cfg, server_conn_t *conn) {
+    char *p, *end, *h;
+    ssize_t n;
+    int used;
+
+    for(;;) {
+        n = read(conn->fd, conn->in + conn->inlen, sizeof(conn->in) - conn->inlen);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && errno == EAGAIN) break;
+        if(n <= 0) {
+            server_close(conn);
+            return false;
+        }
+        conn->inlen += n;
+
+        used = 0;
+        while(used < conn->inlen) {
+            if(conn->skip) {
+                n = conn->inlen - used < conn->skip ? conn->inlen - used : conn->skip;
+                used += n;
+                conn->skip -= n;
+                if(!conn->skip) server_due(cfg, conn);
+                continue;
+            }
+
+            p = conn->in + used;
+            end = memmem(p, conn->inlen - used, "\r\n\r\n", 4);
+            if(!end) break;
+            *end = '\0';
+            used = end + 4 - conn->in;
+
+            for(h=strchr(p, '\n'); h; h=strchr(h, '\n')) {
+                h ++;
+                if(!strncasecmp(h, "Content-Length:", 15)) {
+                    conn->skip = atol(h + 15);
+                } else if(!strncasecmp(h, "Expect:", 7) && strcasestr(h, "100-continue")) {
+                    write_all(conn->fd, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+                }
+            }
+            if(conn->skip <= 0) {
+                conn->skip = 0;
+                server_due(cfg, conn);
+            }
+        }
+        if(used == 0 && conn->inlen == sizeof(conn->in)) {
+            // a header that does not fit
+            server_close(conn);
+            return false;
+        }
+        memmove(conn->in, conn->in + used, conn->inlen - used);
+        conn->inlen -= used;
+    }
+
+    return server_flush(cfg, conn);
+}
+
+void *server_run(void *arg) {
+    const config_t *cfg = (const config_t*) arg;
+    struct epoll_event events[EPOLL_EVENTS], ev;
+    server_conn_t *conn;
+    double now;
+    int i, n, fd, timeout;
+
+    while(server.running) {
+        timeout = 100;
+        if(server.duec) {
+            timeout = (int) ceil((server.dues[server.duei].due - microtime()) * 1000);
+            if(timeout < 0) timeout = 0;
+            if(timeout > 100) timeout = 100;
+        }
+        n = epoll_wait(server.epfd, events, EPOLL_EVENTS, timeout);
+
+        for(i=0; i<n; i++) {
+            conn = (server_conn_t*) events[i].data.ptr;
+            if(!conn) {
+                while((fd = accept4(server.lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    conn = (server_conn_t*) calloc(1, sizeof(server_conn_t));
+                    conn->fd = fd;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = conn;
+                    epoll_ctl(server.epfd, EPOLL_CTL_ADD, fd, &ev);
+                    if(++server.conns > server.max_conns) server.max_conns = server.conns;
+                }
+                continue;
+            }
+            if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                if(!server_read(cfg, conn)) continue;
+            }
+            if(events[i].events & EPOLLOUT) server_flush(cfg, conn);
+        }
+
+        now = microtime();
+        while(server.duec && server.dues[server.duei].due <= now) {
+            conn = server.dues[server.duei].conn;
+            server.duei = (server.duei + 1) % server.duesize;
+            server.duec --;
+            conn->queued --;
+            if(conn->fd < 0) {
+                if(!conn->queued) free(conn);
+                continue;
+            }
+            conn->outq ++;
+            server_flush(cfg, conn);
+        }
+    }
+
+    return NULL;
+}
+
+int server_start(const config_t *cfg) {
+    struct sockaddr_in sa;
+    struct epoll_event ev;
+    socklen_t len = sizeof(sa);
+    char header[256];
+    int n, on = 1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    setsockopt(server.lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(bind(server.lfd, (struct sockaddr*) &sa, sizeof(sa)) || listen(server.lfd, 65535) || getsockname(server.lfd, (struct sockaddr*) &sa, &len)) {
+        fprintf(stderr, "self-test server failure: %s\n", strerror(errno));
+        close(server.lfd);
+        return -1;
+    }
+    snprintf(server.url, sizeof(server.url), "http://127.0.0.1:%d/", ntohs(sa.sin_port));
+
+    n = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %ld\r\n\r\n", cfg->server.size);
+    server.resp_len = n + cfg->server.size;
+    server.resp = (char*) malloc(server.resp_len);
+    memcpy(server.resp, header, n);
+    memset(server.resp + n, 'x', cfg->server.size);
+
+    n = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %ld\r\nConnection: close\r\n\r\n", cfg->server.size);
+    server.resp_close_len = n + cfg->server.size;
+    server.resp_close = (char*) malloc(server.resp_close_len);
+    memcpy(server.resp_close, header, n);
+    memset(server.resp_close + n, 'x', cfg->server.size);
+
+    server.duesize = 1024;
+    server.dues = (server_due_t*) malloc(sizeof(server_due_t) * server.duesize);
+
+    server.epfd = epoll_create1(EPOLL_CLOEXEC);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(server.epfd, EPOLL_CTL_ADD, server.lfd, &ev);
+
+    server.running = true;
+    pthread_create(&server.tid, NULL, server_run, (void*) cfg);
+
+    return 0;
+}
+
+// CPU seconds of the server thread, to tell them apart from the client's
+double server_cpu(void) {
+    struct timespec ts;
+    clockid_t cid;
+
+    if(pthread_getcpuclockid(server.tid, &cid) || clock_gettime(cid, &ts)) return 0;
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+long int self_rss(void) {
+    long int pages = 0, rss = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if(fp) {
+        if(fscanf(fp, "%ld %ld", &pages, &rss) != 2) rss = 0;
+        fclose(fp);
+    }
+
+    return rss * sysconf(_SC_PAGESIZE);
+}
+
+// peak memory the run added, less the server's connections, per client connection
+double conn_memory(const config_t *cfg) {
+    struct rusage ru;
+    double bytes;
+
+    getrusage(RUSAGE_SELF, &ru);
+    bytes = ru.ru_maxrss * 1024.0 - server.base_rss - server.max_conns * sizeof(server_conn_t);
+
+    return bytes > 0 ? bytes / cfg->concurrency : 0;
+}
+
+// the connections left open are not freed, the process is about to exit
+void server_stop(void) {
+    server.running = false;
+    pthread_join(server.tid, NULL);
+    close(server.epfd);
+    close(server.lfd);
+    free(server.resp);
+    free(server.resp_close);
+    free(server.dues);
+}
+
+// --saturation: the load generator's own health over an interval, out of CPU or with a lagging loop it measures itself
+typedef struct {
+    double cpu; // seconds since the process started, less the --self-test server
+    long int ctxsw;
+} health_mark_t;
+
+typedef struct {
+    double cpu; // share of the cores the workers can use
+    long int ctxsw, rss, lag_p99;
+    double per_loop; // completions per loop iteration
+    bool saturated;
+} health_t;
+
+void health_sample(const config_t *cfg, health_t *h, health_mark_t *mark, double seconds, const stats_t *cur, const stats_t *prev) {
+    static hist_t lag;
+    long int vals[HIST_STATS], loops = cur->loops - prev->loops;
+    struct rusage ru;
+    double cpu, cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(h, 0, sizeof(*h));
+    // the coordinator only merges, the agents warn about themselves
+    if(!cfg->coordinator) {
+        getrusage(RUSAGE_SELF, &ru);
+        cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+        if(cfg->self_test) cpu -= server_cpu();
+        if(cores > cfg->threads) cores = cfg->threads;
+        h->cpu = seconds > 0 ? (cpu - mark->cpu) / seconds / cores : 0;
+        h->ctxsw = ru.ru_nvcsw + ru.ru_nivcsw - mark->ctxsw;
+        h->rss = self_rss();
+        mark->cpu = cpu;
+        mark->ctxsw = ru.ru_nvcsw + ru.ru_nivcsw;
+    }
+
+    hist_delta(&lag, &cur->loop_lag, &prev->loop_lag);
+    hist_stats(&lag, vals);
+    h->lag_p99 = vals[HIST_P99];
+    h->per_loop = loops > 0 ? (double) (cur->end_reqs - prev->end_reqs) / loops : 0;
+    h->saturated = h->cpu >= cfg->sat_cpu || h->lag_p99 >= cfg->sat_lag;
+}
+
+void health_warn(const health_t *h) {
+    fprintf(stderr, "warning: load generator saturated, cpu: %.0lf%%, loop lag p99: %.1lfms, latencies are not trustworthy\n", h->cpu * 100, h->lag_p99 / 1000.0);
+}
+
+// a JSON string with quotes, control characters as \u escapes
+void json_print(const char *s) {
+    putchar('"');
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\') {
+            putchar('\\');
+            putchar(*s);
+        } else if((unsigned char) *s < 0x20) {
+            printf("\\u%04x", *s);
+        } else {
+            putchar(*s);
+        }
+    }
+    putchar('"');
+}
+
+void report_header(const config_t *cfg) {
+    int i, j;
+
+    printf("type,time,elapsed,seconds,concurrency,target,keepalives,connections,requests,rate,0xx,1xx,2xx,3xx,4xx,5xx,xxx,req_bytes,res_bytes,debug_bytes,late,dropped,handshakes,resumed,mismatches,failures,new_conns,reused_conns,closed_conns,reqs_per_conn_avg,conn_lifetime_avg_us,cpu,ctx_switches,rss_bytes,loop_lag_p99_us,completions_per_loop,saturated,warmup_requests");
+    for(j=0; j<HIST_STATS; j++) printf(",%s_us", stat_names[j]);
+    if(cfg->phases) {
+        for(i=0; i<PHASES; i++) {
+            for(j=0; j<HIST_STATS; j++) printf(",%s_%s_us", phase_names[i], stat_names[j]);
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+// --output json|csv: counters of cur - prev over seconds, with exact byte counts and latencies in microseconds
+// warm - prev_warm are the warmup requests, they are in none of the other counters
+void report_record(const config_t *cfg, bool summary, double now, double elapsed, double seconds, const stats_t *cur, const stats_t *prev, const health_t *health, const stats_t *warm, const stats_t *prev_warm) {
+    static hist_t h;
+    long int vals[HIST_STATS], pvals[PHASES][HIST_STATS], rvals[HIST_STATS], lvals[HIST_STATS];
+    long int reqs = cur->end_reqs - prev->end_reqs;
+    const char *type = summary ? "summary" : "interval";
+    bool json = (cfg->output == OUTPUT_JSON);
+    int i, j;
+
+    hist_delta(&h, &cur->latency, &prev->latency);
+    hist_stats(&h, vals);
+    hist_delta(&h, &cur->conn_reqs, &prev->conn_reqs);
+    hist_stats(&h, rvals);
+    hist_delta(&h, &cur->conn_life, &prev->conn_life);
+    hist_stats(&h, lvals);
+    if(cfg->phases) {
+        for(i=0; i<PHASES; i++) {
+            hist_delta(&h, &cur->phases[i], &prev->phases[i]);
+            hist_stats(&h, pvals[i]);
+        }
+    }
+
+    printf(json ? "{\"type\":\"%s\",\"time\":%.6lf,\"elapsed\":%.6lf,\"seconds\":%.6lf,\"concurrency\":%d,\"target\":%d,\"keepalives\":%d,\"connections\":%d,\"requests\":%ld,\"rate\":%.3lf,"
+            "\"codes\":{\"0xx\":%ld,\"1xx\":%ld,\"2xx\":%ld,\"3xx\":%ld,\"4xx\":%ld,\"5xx\":%ld,\"xxx\":%ld},"
+            "\"req_bytes\":%ld,\"res_bytes\":%ld,\"debug_bytes\":%ld,\"late\":%ld,\"dropped\":%ld,\"handshakes\":%ld,\"resumed\":%ld,\"mismatches\":%ld,\"failures\":%ld,"
+            "\"conns\":{\"new\":%ld,\"reused\":%ld,\"closed\":%ld,\"reqs_avg\":%ld,\"lifetime_avg_us\":%ld},"
+            "\"client\":{\"cpu\":%.3lf,\"ctx_switches\":%ld,\"rss_bytes\":%ld,\"loop_lag_p99_us\":%ld,\"completions_per_loop\":%.2lf,\"saturated\":%s},\"warmup_requests\":%ld"
+          : "%s,%.6lf,%.6lf,%.6lf,%d,%d,%d,%d,%ld,%.3lf,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%.3lf,%ld,%ld,%ld,%.2lf,%s,%ld",
+        type, now, elapsed, seconds, cur->concurrency, cur->target, cur->keepalives, cur->connections, reqs, seconds > 0 ? reqs / seconds : 0,
+        cur->code0xx - prev->code0xx, cur->code1xx - prev->code1xx, cur->code2xx - prev->code2xx, cur->code3xx - prev->code3xx, cur->code4xx - prev->code4xx, cur->code5xx - prev->code5xx, cur->codex - prev->codex,
+        cur->req_bytes - prev->req_bytes, cur->res_bytes - prev->res_bytes, cur->bug_bytes - prev->bug_bytes, cur->late - prev->late, cur->dropped - prev->dropped, cur->handshakes - prev->handshakes, cur->resumed - prev->resumed, cur->mismatches - prev->mismatches, cur->failures - prev->failures,
+        cur->new_conns - prev->new_conns, cur->reused_conns - prev->reused_conns, cur->conn_reqs.count - prev->conn_reqs.count, rvals[HIST_AVG], lvals[HIST_AVG],
+        health->cpu, health->ctxsw, health->rss, health->lag_p99, health->per_loop, health->saturated ? "true" : "false", warm->end_reqs - prev_warm->end_reqs);
+
+    if(json) {
+        printf(",\"latency_us\":{");
+        for(j=0; j<HIST_STATS; j++) printf("%s\"%s\":%ld", j ? "," : "", stat_names[j], vals[j]);
+        printf("},\"reqs_per_conn\":{");
+        for(j=0; j<HIST_STATS; j++) printf("%s\"%s\":%ld", j ? "," : "", stat_names[j], rvals[j]);
+        printf("},\"conn_lifetime_us\":{");
+        for(j=0; j<HIST_STATS; j++) printf("%s\"%s\":%ld", j ? "," : "", stat_names[j], lvals[j]);
+        printf("}");
+        if(cfg->phases) {
+            printf(",\"phases_us\":{");
+            for(i=0; i<PHASES; i++) {
+                printf("%s\"%s\":{", i ? "," : "", phase_names[i]);
+                for(j=0; j<HIST_STATS; j++) printf("%s\"%s\":%ld", j ? "," : "", stat_names[j], pvals[i][j]);
+                printf("}");
+            }
+            printf("}");
+        }
+    } else {
+        for(j=0; j<HIST_STATS; j++) printf(",%ld", vals[j]);
+        if(cfg->phases) {
+            for(i=0; i<PHASES; i++) {
+                for(j=0; j<HIST_STATS; j++) printf(",%ld", pvals[i][j]);
+            }
+        }
+    }
+
+    if(summary && json && !cfg->coordinator) {
+        struct rusage ru;
+
+        getrusage(RUSAGE_SELF, &ru);
+        printf(",\"cpu_user\":%.6lf,\"cpu_sys\":%.6lf", ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0, ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0);
+        if(cfg->self_test) printf(",\"server_cpu\":%.6lf,\"conn_bytes\":%.0lf", server_cpu(), conn_memory(cfg));
+    }
+    if(summary && json && (cfg->warmup > 0 || cfg->warmup_requests > 0 || cfg->preconnect)) {
+        hist_stats(&warm->latency, vals);
+        printf(",\"warmup\":{\"requests\":%ld,\"latency_us\":{", warm->end_reqs);
+        for(j=0; j<HIST_STATS; j++) printf("%s\"%s\":%ld", j ? "," : "", stat_names[j], vals[j]);
+        printf("}}");
+    }
+    if(summary && json && cfg->expectc) {
+        printf(",\"expect\":{");
+        for(i=0; i<cfg->expectc; i++) {
+            if(i) putchar(',');
+            json_print(cfg->expects[i].arg);
+            printf(":%ld", cur->expect_fails[i]);
+        }
+        printf("}");
+    }
+    printf(json ? "}\n" : "\n");
+    fflush(stdout);
+}
+
+// --url-stats: the workers' counters of every URL are merged into worker 0, text lists the slowest p99 first
+typedef struct {
+    int url;
+    long int vals[HIST_STATS];
+} url_rank_t;
+
+static int url_rank_cmp(const void *a, const void *b) {
+    long int d = ((const url_rank_t*) b)->vals[HIST_P99] - ((const url_rank_t*) a)->vals[HIST_P99];
+
+    return d > 0 ? 1 : (d < 0 ? -1 : ((const url_rank_t*) a)->url - ((const url_rank_t*) b)->url);
+}
+
+void url_report(const config_t *cfg, worker_t *workers, double seconds) {
+    url_stats_t *u, *s;
+    url_rank_t *ranks;
+    int i, j, c, n = 0;
+
+    ranks = (url_rank_t*) malloc(sizeof(url_rank_t) * cfg->urlc);
+    for(i=0; i<cfg->urlc; i++) {
+        for(c=1; c<cfg->threads; c++) {
+            u = workers[0].url_stats[i];
+            s = workers[c].url_stats[i];
+            if(!s) continue;
+            if(!u) {
+                workers[0].url_stats[i] = s;
+                workers[c].url_stats[i] = NULL;
+                continue;
+            }
+            u->reqs += s->reqs;
+            u->req_bytes += s->req_bytes;
+            u->res_bytes += s->res_bytes;
+            u->failures += s->failures;
+            for(j=0; j<7; j++) u->codes[j] += s->codes[j];
+            hist_merge(&u->latency, &s->latency);
+        }
+        if(!workers[0].url_stats[i]) continue;
+        ranks[n].url = i;
+        hist_stats(&workers[0].url_stats[i]->latency, ranks[n].vals);
+        n ++;
+    }
+
+    if(cfg->output == OUTPUT_JSON) {
+        for(i=0; i<n; i++) {
+            u = workers[0].url_stats[ranks[i].url];
+            printf("{\"type\":\"url\",\"index\":%d,\"url\":", ranks[i].url);
+            json_print(cfg->urls[ranks[i].url]);
+            printf(",\"requests\":%ld,\"rate\":%.3lf,\"codes\":{\"0xx\":%ld,\"1xx\":%ld,\"2xx\":%ld,\"3xx\":%ld,\"4xx\":%ld,\"5xx\":%ld,\"xxx\":%ld},\"req_bytes\":%ld,\"res_bytes\":%ld,\"failures\":%ld,\"latency_us\":{",
+                u->reqs, seconds > 0 ? u->reqs / seconds : 0, u->codes[0], u->codes[1], u->codes[2], u->codes[3], u->codes[4], u->codes[5], u->codes[6], u->req_bytes, u->res_bytes, u->failures);
+            for(j=0; j<HIST_STATS; j++) printf("%s\"%s\":%ld", j ? "," : "", stat_names[j], ranks[i].vals[j]);
+            printf("}}\n");
+        }
+    } else {
+        qsort(ranks, n, sizeof(url_rank_t), url_rank_cmp);
+        printf("urls: %d\n", n);
+        for(i=0; i<n; i++) {
+            u = workers[0].url_stats[ranks[i].url];
+            printf("  %s: requests: %ld, reqs: %.1lf/s, 0xx/1xx/2xx/3xx/4xx/5xx/xxx: %ld/%ld/%ld/%ld/%ld/%ld/%ld, failures: %ld, p50/p90/p99/max: %.3lf/%.3lf/%.3lf/%.3lfms\n",
+                cfg->urls[ranks[i].url], u->reqs, seconds > 0 ? u->reqs / seconds : 0, u->codes[0], u->codes[1], u->codes[2], u->codes[3], u->codes[4], u->codes[5], u->codes[6], u->failures,
+                ranks[i].vals[HIST_P50] / 1000.0, ranks[i].vals[HIST_P90] / 1000.0, ranks[i].vals[HIST_P99] / 1000.0, ranks[i].vals[HIST_MAX] / 1000.0);
+        }
+    }
+    fflush(stdout);
+    free(ranks);
+}
+
+// --coordinator/--agent: framed messages over TCP, stats go as raw stats_t so agents must run the same build
+#define DIST_MAGIC "CMDIST01"
+
+enum {
+    MSG_CONFIG = 1, // coordinator -> agent: dist_hello_t, then the arguments to run with, each ended by '\0'
+    MSG_READY,      // agent -> coordinator: set up, waiting for MSG_START
+    MSG_START,      // coordinator -> agent: every agent is ready
+    MSG_STOP,       // coordinator -> agent: interrupted
+    MSG_STATS,      // agent -> coordinator: stats_t so far, every second
+    MSG_DONE,       // agent -> coordinator: final stats_t
+};
+
+typedef struct {
+    uint32_t type;
+    uint32_t len;
+} msg_header_t;
+
+typedef struct {
+    char magic[8];
+    int32_t index, agents;
+    int32_t stats_size;
+    int32_t argc;
+} dist_hello_t;
+
+typedef struct {
+    int fd;
+    pthread_t tid;
+    pthread_mutex_t lock;
+    stats_t stats; // latest MSG_STATS or MSG_DONE
+} dist_agent_t;
+
+static dist_agent_t *dist_agents = NULL;
+static int dist_agentc = 0;
+
+int read_all(int fd, char *ptr, size_t size) {
+    ssize_t n;
+
+    while(size) {
+        n = read(fd, ptr, size);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        ptr += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+int msg_send(int fd, int type, const void *data, size_t len) {
+    msg_header_t h;
+    struct iovec iov[2];
+    struct msghdr mh;
+    ssize_t n;
+
+    h.type = type;
+    h.len = len;
+    iov[0].iov_base = &h;
+    iov[0].iov_len = sizeof(h);
+    iov[1].iov_base = (void*) data;
+    iov[1].iov_len = len;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+
+    // the peer may be gone, which must not raise SIGPIPE
+    while(iov[0].iov_len || iov[1].iov_len) {
+        n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        while(n > 0 && mh.msg_iovlen) {
+            size_t m = (size_t) n < mh.msg_iov->iov_len ? (size_t) n : mh.msg_iov->iov_len;
+
+            mh.msg_iov->iov_base = (char*) mh.msg_iov->iov_base + m;
+            mh.msg_iov->iov_len -= m;
+            n -= m;
+            if(!mh.msg_iov->iov_len) {
+                mh.msg_iov ++;
+                mh.msg_iovlen --;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// a message longer than size is an error, returns its length
+long int msg_recv(int fd, int *type, void *buf, size_t size) {
+    msg_header_t h;
+
+    if(read_all(fd, (char*) &h, sizeof(h)) || h.len > size || read_all(fd, (char*) buf, h.len)) return -1;
+    *type = h.type;
+
+    return h.len;
+}
+
+// [host:]port, an empty host listens on all addresses
+int dist_socket(const char *addr, bool listening) {
+    struct addrinfo hints, *res, *ai;
+    char *buf = strdup(addr), *host = buf, *port = strrchr(buf, ':');
+    int fd = -1, on = 1, ret;
+
+    if(port) {
+        *port++ = '\0';
+    } else {
+        port = buf;
+        host = NULL;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    ret = getaddrinfo(host && *host ? host : NULL, port, &hints, &res);
+    if(ret) {
+        fprintf(stderr, "resolve %s failure: %s\n", addr, gai_strerror(ret));
+        free(buf);
+        return -1;
+    }
+
+    for(ai=res; ai && fd < 0; ai=ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if(fd < 0) continue;
+        if(listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if(!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, 128)) continue;
+        } else if(!connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            continue;
+        }
+        close(fd);
+        fd = -1;
+    }
+    if(fd < 0 && listening) fprintf(stderr, "listen %s failure: %s\n", addr, strerror(errno));
+
+    freeaddrinfo(res);
+    free(buf);
+
+    return fd;
+}
+
+// accepts cfg->agents agents, hands each one its share of -n, -c and --rate, and waits until all are ready
+int coordinator_accept(const config_t *cfg, int argc, char *argv[]) {
+    dist_hello_t hello;
+    char extra[6][32], *buf, *p;
+    int lfd, fd, on = 1, i, j, n, type;
+    size_t len;
+
+    lfd = dist_socket(cfg->coordinator, true);
+    if(lfd < 0) return -1;
+    fprintf(stderr, "waiting for %d agents on %s\n", cfg->agents, cfg->coordinator);
+
+    dist_agents = (dist_agent_t*) calloc(cfg->agents, sizeof(dist_agent_t));
+    while(dist_agentc < cfg->agents) {
+        fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "accept %s failure: %s\n", cfg->coordinator, strerror(errno));
+            close(lfd);
+            return -1;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        i = dist_agentc++;
+        dist_agents[i].fd = fd;
+        pthread_mutex_init(&dist_agents[i].lock, NULL);
+
+        // later options win, so the shares go after the coordinator's own arguments
+        n = 0;
+        strcpy(extra[n++], "-c");
+        snprintf(extra[n++], sizeof(extra[0]), "%ld", (long int) cfg->concurrency * (i + 1) / cfg->agents - (long int) cfg->concurrency * i / cfg->agents);
+        if(cfg->requests > 0) {
+            strcpy(extra[n++], "-n");
+            snprintf(extra[n++], sizeof(extra[0]), "%ld", (long int) cfg->requests * (i + 1) / cfg->agents - (long int) cfg->requests * i / cfg->agents);
+        }
+        if(cfg->rate > 0) {
+            strcpy(extra[n++], "--rate");
+            snprintf(extra[n++], sizeof(extra[0]), "%.6lf", cfg->rate / cfg->agents);
+        }
+
+        memset(&hello, 0, sizeof(hello));
+        memcpy(hello.magic, DIST_MAGIC, sizeof(hello.magic));
+        hello.index = i;
+        hello.agents = cfg->agents;
+        hello.stats_size = sizeof(stats_t);
+        hello.argc = argc - 1 + n;
+
+        len = sizeof(hello);
+        for(j=1; j<argc; j++) len += strlen(argv[j]) + 1;
+        for(j=0; j<n; j++) len += strlen(extra[j]) + 1;
+        buf = p = (char*) malloc(len);
+        memcpy(p, &hello, sizeof(hello));
+        p += sizeof(hello);
+        for(j=1; j<argc; j++) p = stpcpy(p, argv[j]) + 1;
+        for(j=0; j<n; j++) p = stpcpy(p, extra[j]) + 1;
+        msg_send(fd, MSG_CONFIG, buf, len);
+        free(buf);
+    }
+    close(lfd);
+
+    for(i=0; i<dist_agentc; i++) {
+        if(msg_recv(dist_agents[i].fd, &type, NULL, 0) < 0 || type != MSG_READY) {
+            fprintf(stderr, "agent %d failed to start\n", i + 1);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void *coordinator_read(void *arg) {
+    dist_agent_t *a = (dist_agent_t*) arg;
+    stats_t *s = (stats_t*) malloc(sizeof(stats_t));
+    int type = 0;
+
+    while(msg_recv(a->fd, &type, s, sizeof(stats_t)) == sizeof(stats_t) && (type == MSG_STATS || type == MSG_DONE)) {
+        pthread_mutex_lock(&a->lock);
+        memcpy(&a->stats, s, sizeof(stats_t));
+        pthread_mutex_unlock(&a->lock);
+        if(type == MSG_DONE) break;
+    }
+    if(type != MSG_DONE) fprintf(stderr, "agent %d lost\n", (int) (a - dist_agents) + 1);
+    free(s);
+
+    // agents count as workers, the last one wakes up main thread for the final report
+    if(__atomic_sub_fetch(&workers_running, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_kill(main_thread, SIGALRM);
+    }
+
+    return NULL;
+}
+
+void coordinator_start(void) {
+    int i;
+
+    for(i=0; i<dist_agentc; i++) msg_send(dist_agents[i].fd, MSG_START, NULL, 0);
+    for(i=0; i<dist_agentc; i++) pthread_create(&dist_agents[i].tid, NULL, coordinator_read, &dist_agents[i]);
+}
+
+void coordinator_stop(void) {
+    int i;
+
+    for(i=0; i<dist_agentc; i++) msg_send(dist_agents[i].fd, MSG_STOP, NULL, 0);
+}
+
+void coordinator_merge(stats_t *total, bool phases) {
+    int i;
+
+    for(i=0; i<dist_agentc; i++) {
+        pthread_mutex_lock(&dist_agents[i].lock);
+        stats_merge(total, &dist_agents[i].stats, phases);
+        pthread_mutex_unlock(&dist_agents[i].lock);
+    }
+}
+
+void coordinator_cleanup(void) {
+    int i;
+
+    for(i=0; i<dist_agentc; i++) {
+        if(dist_agents[i].tid) pthread_join(dist_agents[i].tid, NULL);
+        close(dist_agents[i].fd);
+        pthread_mutex_destroy(&dist_agents[i].lock);
+    }
+    free(dist_agents);
+}
+
+// connects to the coordinator, retrying for 10 seconds, and turns its MSG_CONFIG into the arguments to run with
+int agent_join(const char *addr, char *argv0, int *argc, char ***argv) {
+    msg_header_t h;
+    dist_hello_t hello;
+    char *buf, *p, **args;
+    int fd = -1, i;
+
+    for(i=0; i<100 && fd < 0; i++) {
+        fd = dist_socket(addr, false);
+        if(fd < 0) usleep(100000);
+    }
+    if(fd < 0) {
+        fprintf(stderr, "connect %s failure: %s\n", addr, strerror(errno));
+        return -1;
+    }
+
+    if(read_all(fd, (char*) &h, sizeof(h)) || h.type != MSG_CONFIG || h.len < sizeof(hello)) {
+        fprintf(stderr, "no config from %s\n", addr);
+        close(fd);
+        return -1;
+    }
+    // the arguments stay in buf for the whole run
+    buf = (char*) malloc(h.len + 1);
+    if(read_all(fd, buf, h.len)) {
+        fprintf(stderr, "no config from %s\n", addr);
+        close(fd);
+        return -1;
+    }
+    buf[h.len] = '\0';
+    memcpy(&hello, buf, sizeof(hello));
+    if(memcmp(hello.magic, DIST_MAGIC, sizeof(hello.magic)) || hello.stats_size != sizeof(stats_t)) {
+        fprintf(stderr, "coordinator %s runs another version\n", addr);
+        close(fd);
+        return -1;
+    }
+
+    args = (char**) malloc(sizeof(char*) * (hello.argc + 2));
+    args[0] = argv0;
+    p = buf + sizeof(hello);
+    for(i=0; i<hello.argc && p < buf + h.len; i++) {
+        args[i + 1] = p;
+        p += strlen(p) + 1;
+    }
+    args[i + 1] = NULL;
+    *argc = i + 1;
+    *argv = args;
+    fprintf(stderr, "agent %d/%d of %s\n", hello.index + 1, hello.agents, addr);
+
+    return fd;
+}
+
+// MSG_STOP or a lost coordinator interrupt the agent like SIGINT
+void *agent_read(void *arg) {
+    int fd = (int) (long int) arg, type = 0;
+
+    while(msg_recv(fd, &type, NULL, 0) == 0 && type != MSG_STOP);
+    pthread_kill(main_thread, SIGINT);
 
-    // set GET
-    if(cfg->get) curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    return NULL;
+}
 
-    // set METHOD
-    if(cfg->method) curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, cfg->method);
+int agent_ready(int fd) {
+    pthread_t tid;
+    int type = 0;
 
-    idx->time = microtime();
+    msg_send(fd, MSG_READY, NULL, 0);
+    if(msg_recv(fd, &type, NULL, 0) < 0 || type != MSG_START) {
+        fprintf(stderr, "coordinator did not start\n");
+        return -1;
+    }
+    pthread_create(&tid, NULL, agent_read, (void*) (long int) fd);
+    pthread_detach(tid);
 
-    return curl;
+    return 0;
 }
 
-enum {
-    FORM_STRING = 128,
-    TIMEOUT,
-    CONNECT_TIMEOUT,
-};
-static const char *options = "hViD:vH:Im:d:GF:C:f:saT:k:n:t:c:w:";
-static struct option OPTIONS[] = {
-    {"help",            0, 0, 'h' },
-    {"version",         0, 0, 'V' },
-    {"info",            0, 0, 'i' },
-    {"debug",           1, 0, 'D' },
+// --find-capacity: every level of concurrency is held for cfg->hold seconds, the first second is not measured
+#define CAPACITY_POINTS 64
 
-    {"verbose",         0, 0, 'v' },
-    {"header",          1, 0, 'H' },
-    {"head",            0, 0, 'I'},
-    {"method",          1, 0, 'm' },
-    {"data",            1, 0, 'd' },
-    {"get",             0, 0, 'G' },
-    {"form",            1, 0, 'F' },
-    {"form-string",     1, 0, FORM_STRING },
-    {"cookie",          1, 0, 'C' },
-    {"cookie-file",     1, 0, 'f' },
-    {"cookie-session",  0, 0, 's' },
-    {"append",          0, 0, 'a' },
-    {"upload-file",     1, 0, 'T' },
-    {"keepalive",       1, 0, 'k' },
-    {"timeout",         1, 0, TIMEOUT },
-    {"connect-timeout", 1, 0, CONNECT_TIMEOUT },
+typedef struct {
+    int level;
+    double rate, err;
+    long int vals[HIST_STATS];
+    bool ok;
+} capacity_point_t;
 
-    {"requests",        0, 0, 'n' },
-    {"timelimit",       0, 0, 't' },
-    {"concurrency",     0, 0, 'c' },
+typedef struct {
+    int level, good, bad;
+    double since, mark_time;
+    bool measuring, done;
+    stats_t mark;
+    int pointc;
+    capacity_point_t points[CAPACITY_POINTS];
+} capacity_t;
 
-    {"weight",          0, 0, 'w' },
+static long int errors(const stats_t *s) {
+    return s->code0xx + s->code4xx + s->code5xx + s->codex;
+}
 
-    {NULL,              0, 0, 0 }
-};
+// doubles the level while the SLO holds, then bisects between the last good and the first bad level
+void capacity_step(const config_t *cfg, capacity_t *cap, const stats_t *total, double now) {
+    static hist_t h;
+    capacity_point_t *pt;
+    long int reqs;
+    int i, next;
 
-void usage(char *argv0) {
-    printf(
-        "Usage: %s [options...] <url>...\n"
-        "  -h,--help                         This help\n"
-        "  -V,--version                      Show curl version\n"
-        "  -i,--info                         Show config info\n"
-        "  -D,--debug <path>                 Save debug info to <path>\n"
+    if(now - cap->since < 1 - 0.05) return;
+    if(!cap->measuring) {
+        memcpy(&cap->mark, total, sizeof(*total));
+        cap->mark_time = now;
+        cap->measuring = true;
+        return;
+    }
+    if(now - cap->since < cfg->hold - 0.05) return;
 
-        "  -v,--verbose                      Make the operation more talkative\n"
-        "  -H,--header <header>              Set custom request header\n"
-        "  -I,--head                         Show document info only\n"
-        "  -m,--method <method>              Custom request method\n"
-        "  -d,--data <data>                  HTTP POST data\n"
-        "  -G,--get                          Put the post data in the URL and use GET\n"
-        "  -F,--form <name=content>          Specify multipart MIME data\n"
-        "     --form-string <name=string>    Specify multipart MIME data\n"
-        "  -C,--cookie <data|filename>       Send cookies from string/file\n"
-        "  -f,--cookie-file <filename>       Read or write cookies file <filename>\n"
-        "  -s,--cookie-session               Start a new cookie session\n"
-        "  -a,--append                       Append to target file when uploading\n"
-        "  -T,--upload-file <file>           Transfer local FILE to destination\n"
-        "  -k,--keepalive <seconds>          Enable TCP keep-alive\n"
-        "     --timeout <seconds>            Request timeout\n"
-        "     --connect-timeout <seconds>    Connect timeout\n"
+    pt = &cap->points[cap->pointc < CAPACITY_POINTS ? cap->pointc++ : CAPACITY_POINTS - 1];
+    reqs = total->end_reqs - cap->mark.end_reqs;
+    hist_delta(&h, &total->latency, &cap->mark.latency);
+    hist_stats(&h, pt->vals);
+    pt->level = cap->level;
+    pt->rate = reqs / (now - cap->mark_time);
+    pt->err = reqs > 0 ? (double) (errors(total) - errors(&cap->mark)) / reqs : 0;
+    pt->ok = (reqs > 0 && (cfg->slo_err < 0 || pt->err <= cfg->slo_err));
+    for(i=0; i<cfg->sloc && pt->ok; i++) {
+        pt->ok = (pt->vals[cfg->slos[i].stat] <= cfg->slos[i].max);
+    }
 
-        "  -n,--requests <requests>          Number of requests to perform\n"
-        "  -t,--timelimit <seconds>          Seconds to max. to spend on benchmarking\n"
-        "  -c,--concurrency <concurrency>    Number of multiple requests to make at a time\n"
+    if(pt->ok) {
+        cap->good = cap->level;
+    } else {
+        cap->bad = cap->level;
+    }
+    if(cap->bad) {
+        next = (cap->good + cap->bad) / 2;
+        // within 5% of the answer is close enough
+        if(cap->bad - cap->good <= (cap->good / 20 > 1 ? cap->good / 20 : 1)) next = 0;
+    } else {
+        next = cap->level * 2 > cfg->concurrency ? cfg->concurrency : cap->level * 2;
+        if(cap->level >= cfg->concurrency) next = 0;
+    }
 
-        "  -w,--weight <weight>              URL weights\n"
-        , argv0
-    );
+    if(next <= 0 || cap->pointc >= CAPACITY_POINTS) {
+        cap->done = true;
+        return;
+    }
+    cap->level = next;
+    cap->since = now;
+    cap->measuring = false;
+    STAT_SET(capacity_target, next);
+}
+
+static int capacity_cmp(const void *a, const void *b) {
+    return ((const capacity_point_t*) a)->level - ((const capacity_point_t*) b)->level;
 }
 
-volatile bool is_running = true, is_timer = false;
-void sig_handler(int sig) {
-    if(sig == SIGALRM) {
-        is_timer = true;
+// the highest good level, the measured curve, and the knee where rate / latency (Kleinrock's power) peaks
+void capacity_report(const config_t *cfg, capacity_t *cap) {
+    capacity_point_t *best = NULL, *knee = NULL;
+    FILE *fp = (cfg->output == OUTPUT_CSV ? stderr : stdout);
+    int i;
+
+    qsort(cap->points, cap->pointc, sizeof(capacity_point_t), capacity_cmp);
+    for(i=0; i<cap->pointc; i++) {
+        capacity_point_t *pt = &cap->points[i];
+
+        if(pt->ok && (!best || pt->level > best->level)) best = pt;
+        if(pt->vals[HIST_AVG] > 0 && (!knee || pt->rate / pt->vals[HIST_AVG] > knee->rate / knee->vals[HIST_AVG])) knee = pt;
+    }
+
+    if(cfg->output == OUTPUT_JSON) {
+        for(i=0; i<cap->pointc; i++) {
+            capacity_point_t *pt = &cap->points[i];
+
+            printf("{\"type\":\"capacity_point\",\"concurrency\":%d,\"rate\":%.3lf,\"err\":%.6lf,\"ok\":%s,\"latency_us\":{\"min\":%ld,\"avg\":%ld,\"p50\":%ld,\"p90\":%ld,\"p99\":%ld,\"p999\":%ld,\"max\":%ld}}\n",
+                pt->level, pt->rate, pt->err, pt->ok ? "true" : "false", pt->vals[HIST_MIN], pt->vals[HIST_AVG], pt->vals[HIST_P50], pt->vals[HIST_P90], pt->vals[HIST_P99], pt->vals[HIST_P999], pt->vals[HIST_MAX]);
+        }
+        printf("{\"type\":\"capacity\",\"concurrency\":%d,\"rate\":%.3lf,\"knee\":%d,\"knee_rate\":%.3lf,\"limited\":%s}\n",
+            best ? best->level : 0, best ? best->rate : 0, knee ? knee->level : 0, knee ? knee->rate : 0, best && best->level >= cfg->concurrency ? "true" : "false");
+        fflush(stdout);
+        return;
+    }
+
+    fprintf(fp, "======== CAPACITY BEGIN ========\n");
+    for(i=0; i<cap->pointc; i++) {
+        capacity_point_t *pt = &cap->points[i];
+
+        fprintf(fp, "%s concurrency: %d, reqs: %.1lf/s, err: %.3lf%%, p50: %.3lfms, p90: %.3lfms, p99: %.3lfms, p99.9: %.3lfms, max: %.3lfms%s\n", pt->ok ? "  ok" : "fail",
+            pt->level, pt->rate, pt->err * 100, pt->vals[HIST_P50] / 1000.0, pt->vals[HIST_P90] / 1000.0, pt->vals[HIST_P99] / 1000.0, pt->vals[HIST_P999] / 1000.0, pt->vals[HIST_MAX] / 1000.0, pt == knee ? " <= knee" : "");
+    }
+    if(best) {
+        fprintf(fp, "capacity: concurrency: %d, reqs: %.1lf/s%s\n", best->level, best->rate, best->level >= cfg->concurrency ? " (limited by -c)" : "");
     } else {
-        is_running = false;
-        // printf("SIG: %d\n", sig);
+        fprintf(fp, "capacity: no level meets the SLO\n");
     }
+    if(knee) fprintf(fp, "knee: concurrency: %d, reqs: %.1lf/s\n", knee->level, knee->rate);
+    fprintf(fp, "========= CAPACITY END =========\n");
 }
 
 int main(int argc, char *argv[]) {
     config_t cfg;
-    int c, ind = 0;
+    int c, i, ind = 0, ret = EXIT_SUCCESS;
+    bool idle_start;
     idx_t *idxs;
-    CURLM *multi;
-    char fmt[64], *weight = NULL, keepAlive[64];
+    worker_t *workers;
+    sigset_t sigset;
+    pthread_t trace_thread;
+    char *weight = NULL, keepAlive[64], *agent = NULL, *self_url, *tmpl_bufs = NULL, *expect_bufs = NULL;
+    struct curl_slist *tmpl_headers = NULL;
+    int agent_fd = -1;
 
+    // an agent parses the arguments the coordinator sends in place of its own
+parse:
     memset(&cfg, 0, sizeof(cfg));
 
     cfg.isatty_stdout = isatty(STDOUT_FILENO);
     cfg.isatty_stderr = isatty(STDERR_FILENO);
-    cfg.concurrency = 10;
+    cfg.concurrency = 0;
     cfg.timeout = 30;
     cfg.connect_timeout = 10;
+    cfg.threads = 1;
+    cfg.seed = -1;
+    cfg.interval = 1;
+    cfg.sat_cpu = 0.9;
+    cfg.sat_lag = 10000;
 
     while((c = getopt_long(argc, argv, options, OPTIONS, &ind)) != -1) {
         switch(c) {
@@ -478,6 +4233,49 @@ int main(int argc, char *argv[]) {
             case 'D':
                 cfg.debug = optarg;
                 break;
+            case DECODE:
+                exit(trace_decode(optarg) ? EXIT_FAILURE : 0);
+                break;
+            case OUTPUT: // output
+                if(!strcmp(optarg, "text")) {
+                    cfg.output = OUTPUT_TEXT;
+                } else if(!strcmp(optarg, "json")) {
+                    cfg.output = OUTPUT_JSON;
+                } else if(!strcmp(optarg, "csv")) {
+                    cfg.output = OUTPUT_CSV;
+                } else {
+                    fprintf(stderr, "unknown output format: %s\n", optarg);
+                    goto fail;
+                }
+                break;
+            case INTERVAL: // interval
+                cfg.interval = parse_seconds(optarg);
+                if(cfg.interval < 0.001) {
+                    fprintf(stderr, "invalid interval, 1ms at least: %s\n", optarg);
+                    goto fail;
+                }
+                break;
+            case REQUEST_LOG: // request-log
+                cfg.request_log = optarg;
+                break;
+            case SELF_TEST: // self-test
+                if(parse_self_test(&cfg, optarg)) {
+                    fprintf(stderr, "invalid self-test: %s\n", optarg);
+                    goto fail;
+                }
+                break;
+            case SATURATION: // saturation
+                if(parse_saturation(&cfg, optarg)) {
+                    fprintf(stderr, "invalid saturation: %s\n", optarg);
+                    goto fail;
+                }
+                break;
+            case EXPECT: // expect
+                if(parse_expect(&cfg, optarg)) {
+                    fprintf(stderr, "invalid expect: %s\n", optarg);
+                    goto fail;
+                }
+                break;
 
             case 'v':
                 cfg.verbose = true;
@@ -516,7 +4314,7 @@ int main(int argc, char *argv[]) {
                     if(is_file && access(cfg.forms[cfg.formc].value, R_OK)) {
                         fprintf(stderr, "form file not exists: name: %s, value: %s\n", cfg.forms[cfg.formc].name, cfg.forms[cfg.formc].value);
                         cfg.formc++;
-                        goto end;
+                        goto fail;
                     }
                 } else {
                     cfg.forms[cfg.formc].name = strdup(optarg);
@@ -541,7 +4339,7 @@ int main(int argc, char *argv[]) {
                 cfg.upload_file = optarg;
                 if(access(cfg.upload_file, R_OK)) {
                     fprintf(stderr, "upload file not exists: %s\n", cfg.upload_file);
-                    goto end;
+                    goto fail;
                 }
                 break;
             case 'k': // keepalive
@@ -560,6 +4358,55 @@ int main(int argc, char *argv[]) {
             case CONNECT_TIMEOUT: // connect-timeout
             	cfg.connect_timeout = abs(atoi(optarg));
             	break;
+            case NO_REUSE: // no-reuse
+                cfg.no_reuse = true;
+                break;
+            case REQUESTS_PER_CONN: // requests-per-conn
+                cfg.requests_per_conn = atoi(optarg);
+                if(cfg.requests_per_conn < 0) cfg.requests_per_conn = 0;
+                break;
+            case SHARE: // share
+                cfg.share = true;
+                break;
+            case INSECURE: // insecure
+                cfg.insecure = true;
+                break;
+            case HTTP2: // http2
+                cfg.http_version = CURL_HTTP_VERSION_2_0;
+                break;
+            case HTTP2_PRIOR_KNOWLEDGE: // http2-prior-knowledge
+                cfg.http_version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+                break;
+            case MAX_HOST_CONNECTIONS: // max-host-connections
+                cfg.max_host_connections = atoi(optarg);
+                if(cfg.max_host_connections < 0) cfg.max_host_connections = 0;
+                break;
+            case MAX_STREAMS: // max-streams
+                cfg.max_streams = atoi(optarg);
+                if(cfg.max_streams < 0) cfg.max_streams = 0;
+                break;
+            case PHASES_OPT: // phases
+                cfg.phases = true;
+                break;
+            case BODY: // body
+                if(!strcmp(optarg, "discard")) {
+                    cfg.body = BODY_DISCARD;
+                } else if(!strcmp(optarg, "stderr")) {
+                    cfg.body = BODY_STDERR;
+                } else if(!strcmp(optarg, "checksum")) {
+                    cfg.body = BODY_CHECKSUM;
+                } else if(!strncmp(optarg, "sample:", 7) && atoi(optarg + 7) > 0 && strchr(optarg + 7, ':')) {
+                    cfg.body = BODY_SAMPLE;
+                    cfg.sample_every = atoi(optarg + 7);
+                    cfg.sample_file = strchr(optarg + 7, ':') + 1;
+                } else {
+                    fprintf(stderr, "unknown body sink: %s\n", optarg);
+                    goto fail;
+                }
+                break;
+            case EPOLL: // epoll
+                cfg.epoll = true;
+                break;
             
             case 'n': // requests
                 cfg.requests = atoi(optarg);
@@ -571,10 +4418,76 @@ int main(int argc, char *argv[]) {
                 cfg.concurrency = atoi(optarg);
                 if(cfg.concurrency <= 0) cfg.concurrency = 1;
                 break;
+            case THREADS: // threads
+                cfg.threads = atoi(optarg);
+                if(cfg.threads <= 0) cfg.threads = 1;
+                break;
+            case WARMUP: // warmup
+                cfg.warmup = parse_seconds(optarg);
+                if(cfg.warmup < 0) {
+                    fprintf(stderr, "invalid warmup time: %s\n", optarg);
+                    goto fail;
+                }
+                break;
+            case WARMUP_REQUESTS: // warmup-requests
+                cfg.warmup_requests = atoi(optarg);
+                if(cfg.warmup_requests < 0) cfg.warmup_requests = 0;
+                break;
+            case PRECONNECT: // preconnect
+                cfg.preconnect = true;
+                break;
+            case RATE: // rate
+                cfg.rate = atof(optarg);
+                if(cfg.rate < 0) cfg.rate = 0;
+                break;
+            case POISSON: // poisson
+                cfg.poisson = true;
+                break;
+            case FIND_CAPACITY: // find-capacity
+                if(parse_capacity(&cfg, optarg)) {
+                    fprintf(stderr, "invalid SLO: %s\n", optarg);
+                    goto fail;
+                }
+                break;
+            case COORDINATOR: // coordinator
+                cfg.coordinator = optarg;
+                break;
+            case AGENTS: // agents
+                cfg.agents = atoi(optarg);
+                break;
+            case AGENT: // agent
+                cfg.agent = optarg;
+                break;
+            case PROFILE: // profile
+                if(parse_profile(&cfg, optarg)) {
+                    fprintf(stderr, "invalid profile: %s\n", optarg);
+                    goto fail;
+                }
+                break;
 
             case 'w': // weight
                 weight = optarg;
                 break;
+            case URL_FILE: // url-file
+                cfg.url_file = optarg;
+                break;
+            case RANDOM: // random
+                cfg.random = true;
+                break;
+            case SEED: // seed
+                cfg.seed = atol(optarg);
+                if(cfg.seed < 0) cfg.seed = -1;
+                break;
+            case URL_STATS: // url-stats
+                cfg.url_stats = true;
+                break;
+            case CORPUS: // corpus
+                cfg.corpus_file = optarg;
+                break;
+            case REPLAY_SPEED: // replay-speed
+                cfg.replay_speed = atof(optarg);
+                if(cfg.replay_speed < 0) cfg.replay_speed = 0;
+                break;
 
             case 'h':
             default:
@@ -583,7 +4496,19 @@ int main(int argc, char *argv[]) {
                 break;
         }
     }
-    if(optind >= argc) {
+    if(agent_fd >= 0) {
+        cfg.coordinator = NULL;
+        cfg.agents = 0;
+        cfg.agent = agent;
+        cfg.agent_fd = agent_fd;
+    } else if(cfg.agent) {
+        agent = cfg.agent;
+        agent_fd = agent_join(agent, argv[0], &argc, &argv);
+        if(agent_fd < 0) exit(EXIT_FAILURE);
+        optind = 0;
+        goto parse;
+    }
+    if(optind >= argc && !cfg.corpus_file && !cfg.url_file && !cfg.self_test) {
         fprintf(stderr, "ERROR: At least one URL.\n");
         usage(argv[0]);
         exit(EXIT_FAILURE);
@@ -592,6 +4517,77 @@ int main(int argc, char *argv[]) {
     cfg.urlc = argc - optind;
     cfg.urls = argv + optind;
 
+    // --profile sizes the idxs for its peak and ends with its last stage
+    if(cfg.stagec) {
+        double seconds = 0;
+
+        if(cfg.rate > 0) {
+            fprintf(stderr, "--profile can not be used with --rate\n");
+            goto fail;
+        }
+        cfg.concurrency = 0;
+        for(c=0; c<cfg.stagec; c++) {
+            if(cfg.stages[c].from > cfg.concurrency) cfg.concurrency = cfg.stages[c].from;
+            if(cfg.stages[c].to > cfg.concurrency) cfg.concurrency = cfg.stages[c].to;
+            seconds += cfg.stages[c].seconds;
+        }
+        if(cfg.concurrency <= 0) {
+            fprintf(stderr, "profile never goes above 0 concurrency\n");
+            goto fail;
+        }
+        if(cfg.timelimit <= 0) cfg.timelimit = (int) ceil(seconds);
+    }
+
+    if(cfg.self_test && (optind < argc || cfg.corpus_file || cfg.url_file || cfg.coordinator || cfg.http_version)) {
+        fprintf(stderr, "--self-test serves HTTP/1.1 for its own URL, and can not be used with <url>s, --corpus, --url-file, --coordinator or --http2\n");
+        goto fail;
+    }
+    if(cfg.preconnect && cfg.no_reuse) {
+        fprintf(stderr, "--preconnect can not be used with --no-reuse, no connection outlives its request\n");
+        goto fail;
+    }
+    if(cfg.requests_per_conn && cfg.http_version) {
+        fprintf(stderr, "--requests-per-conn can not be used with --http2, streams share their connection\n");
+        goto fail;
+    }
+    if(cfg.corpus_file && (cfg.url_file || cfg.random || cfg.url_stats)) {
+        fprintf(stderr, "--url-file, --random and --url-stats can not be used with --corpus\n");
+        goto fail;
+    }
+    if(cfg.url_stats && cfg.output == OUTPUT_CSV) {
+        fprintf(stderr, "--url-stats is reported in text and json output only\n");
+        goto fail;
+    }
+
+    if(cfg.replay_speed > 0 && (!cfg.corpus_file || cfg.rate > 0 || cfg.stagec)) {
+        fprintf(stderr, "--replay-speed needs --corpus, and can not be used with --rate or --profile\n");
+        goto fail;
+    }
+
+    // --find-capacity searches concurrency up to -c
+    if(cfg.capacity && (cfg.rate > 0 || cfg.stagec)) {
+        fprintf(stderr, "--find-capacity can not be used with --rate or --profile\n");
+        goto fail;
+    }
+    if(cfg.concurrency <= 0) cfg.concurrency = cfg.capacity ? 1000 : 10;
+
+    if(cfg.coordinator) {
+        if(cfg.agents <= 0) {
+            fprintf(stderr, "--coordinator needs --agents\n");
+            goto fail;
+        }
+        if(cfg.stagec || cfg.capacity || cfg.url_stats) {
+            fprintf(stderr, "--profile, --find-capacity and --url-stats can not be used with --coordinator\n");
+            goto fail;
+        }
+        if(cfg.concurrency < cfg.agents || (cfg.requests > 0 && cfg.requests < cfg.agents)) {
+            fprintf(stderr, "-c and -n can not be less than --agents\n");
+            goto fail;
+        }
+    }
+
+    if(cfg.body == BODY_DEFAULT) cfg.body = (cfg.isatty_stderr || cfg.agent || cfg.self_test ? BODY_DISCARD : BODY_STDERR);
+
     if(weight) {
         cfg.urlw = (int*) malloc(sizeof(int) * cfg.urlc);
         for(c=0; c<cfg.urlc; c++) {
@@ -607,10 +4603,29 @@ int main(int argc, char *argv[]) {
             }
         }
     }
+    // files named by the arguments are read by the agents
+    if(cfg.url_file && !cfg.coordinator) {
+        if(url_file_load(&cfg, cfg.url_file)) goto fail;
+        if(!cfg.urlc) {
+            fprintf(stderr, "ERROR: At least one URL.\n");
+            goto fail;
+        }
+    }
 
     if(cfg.info) {
         printf("======== CONFIG INFO BEGIN ========\n");
         printf("debug: %s\n", cfg.debug ? cfg.debug : "");
+        printf("output: %s\n", cfg.output == OUTPUT_JSON ? "json" : (cfg.output == OUTPUT_CSV ? "csv" : "text"));
+        printf("interval: %gms\n", cfg.interval * 1000);
+        printf("request_log: %s\n", cfg.request_log ? cfg.request_log : "");
+        printf("self_test: ");
+        if(cfg.self_test) printf("size=%ld,delay=%gms,close=%d", cfg.server.size, cfg.server.delay * 1000, cfg.server.close);
+        printf("\n");
+        printf("saturation: cpu=%g%%,lag=%gms\n", cfg.sat_cpu * 100, cfg.sat_lag / 1000.0);
+        printf("expects: %d\n", cfg.expectc);
+        for(c=0; c<cfg.expectc; c++) {
+            printf("  %d => %s\n", c, cfg.expects[c].arg);
+        }
         printf("verbose: %s\n", cfg.verbose ? "true" : "false");
         printf("headers: %d\n", cfg.headerc);
         for(c=0; c<cfg.headerc; c++) {
@@ -631,7 +4646,24 @@ int main(int argc, char *argv[]) {
         printf("keepalive: %d\n", cfg.keepalive);
         printf("timeout: %d\n", cfg.timeout);
         printf("connect_timeout: %d\n", cfg.connect_timeout);
+        printf("no_reuse: %s\n", cfg.no_reuse ? "true" : "false");
+        printf("requests_per_conn: %d\n", cfg.requests_per_conn);
+        printf("share: %s\n", cfg.share ? "true" : "false");
+        printf("insecure: %s\n", cfg.insecure ? "true" : "false");
+        printf("http_version: %s\n", cfg.http_version == CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE ? "2-prior-knowledge" : (cfg.http_version ? "2" : ""));
+        printf("max_host_connections: %d\n", cfg.max_host_connections);
+        printf("max_streams: %d\n", cfg.max_streams);
+        printf("phases: %s\n", cfg.phases ? "true" : "false");
+        printf("body: %s\n", body_names[cfg.body]);
+        if(cfg.body == BODY_SAMPLE) printf("sample: 1/%d => %s\n", cfg.sample_every, cfg.sample_file);
+        printf("epoll: %s\n", cfg.epoll ? "true" : "false");
         printf("\n");
+        printf("corpus: %s\n", cfg.corpus_file ? cfg.corpus_file : "");
+        printf("replay_speed: %g\n", cfg.replay_speed);
+        printf("url_file: %s\n", cfg.url_file ? cfg.url_file : "");
+        printf("random: %s\n", cfg.random ? "true" : "false");
+        printf("seed: %ld\n", cfg.seed);
+        printf("url_stats: %s\n", cfg.url_stats ? "true" : "false");
         printf("urls: %d\n", cfg.urlc);
         for(c=0; c<cfg.urlc; c++) {
             printf("  %d => [%d] %s\n", c, cfg.urlw ? cfg.urlw[c] : 1, cfg.urls[c]);
@@ -640,217 +4672,503 @@ int main(int argc, char *argv[]) {
         printf("requests: %d\n", cfg.requests);
         printf("timelimit: %d\n", cfg.timelimit);
         printf("concurrency: %d\n", cfg.concurrency);
+        printf("threads: %d\n", cfg.threads);
+        printf("warmup: %gs\n", cfg.warmup);
+        printf("warmup_requests: %d\n", cfg.warmup_requests);
+        printf("preconnect: %s\n", cfg.preconnect ? "true" : "false");
+        printf("rate: %.1lf\n", cfg.rate);
+        printf("poisson: %s\n", cfg.poisson ? "true" : "false");
+        printf("find_capacity: ");
+        for(c=0; c<cfg.sloc; c++) printf("%s%s<%.3lfms", c ? "," : "", stat_names[cfg.slos[c].stat], cfg.slos[c].max / 1000.0);
+        if(cfg.capacity && cfg.slo_err >= 0) printf("%serr<%g%%", cfg.sloc ? "," : "", cfg.slo_err * 100);
+        if(cfg.capacity) printf(",hold=%gs", cfg.hold);
+        printf("\n");
+        printf("profile: ");
+        for(c=0; c<cfg.stagec; c++) {
+            if(cfg.stages[c].from != cfg.stages[c].to) {
+                printf("%s%d-%d@%gs", c ? "," : "", cfg.stages[c].from, cfg.stages[c].to, cfg.stages[c].seconds);
+            } else {
+                printf("%s%d@%gs", c ? "," : "", cfg.stages[c].to, cfg.stages[c].seconds);
+            }
+        }
+        printf("\n");
+        printf("coordinator: %s\n", cfg.coordinator ? cfg.coordinator : "");
+        printf("agents: %d\n", cfg.agents);
         printf("========= CONFIG INFO END =========\n");
         goto end;
     }
 
+    if(cfg.coordinator) {
+        if(coordinator_accept(&cfg, argc, argv)) goto fail;
+        cfg.debug = NULL;
+        cfg.request_log = NULL;
+    }
+
+    if(cfg.self_test) {
+        if(server_start(&cfg)) goto fail;
+        self_url = server.url;
+        cfg.urls = &self_url;
+        cfg.urlc = 1;
+    }
+
+    if(cfg.corpus_file && !cfg.coordinator) {
+        if(corpus_load(&cfg, cfg.corpus_file)) goto fail;
+        // one pass over the corpus unless -n or -t say otherwise
+        if(cfg.requests <= 0 && cfg.timelimit <= 0) cfg.requests = cfg.corpusc;
+    }
+
+    // -T and -F @file are read from memory by every request
+    if(!cfg.coordinator) {
+        if(cfg.upload_file && !(cfg.upload_map = map_file(cfg.upload_file, &cfg.upload_size))) goto fail;
+        for(c=0; c<cfg.formc; c++) {
+            if(cfg.forms[c].is_file && !(cfg.forms[c].map = map_file(cfg.forms[c].value, &cfg.forms[c].size))) goto fail;
+        }
+        if(tmpl_setup(&cfg)) goto fail;
+    }
+
     curl_global_init(CURL_GLOBAL_ALL);
 
+    if(cfg.requests > 0 && cfg.concurrency > cfg.requests) cfg.concurrency = cfg.requests;
+    if(cfg.threads > cfg.concurrency) cfg.threads = cfg.concurrency;
+    if(cfg.coordinator) cfg.threads = 0;
+
+    if(cfg.self_test) server.base_rss = self_rss();
+
     idxs = (idx_t*) malloc(sizeof(idx_t) * cfg.concurrency);
-    multi = curl_multi_init();
+    workers = (worker_t*) malloc(sizeof(worker_t) * cfg.threads);
 
     memset(idxs, 0, sizeof(idx_t) * cfg.concurrency);
+    memset(workers, 0, sizeof(worker_t) * cfg.threads);
 
     if(cfg.debug) {
-        snprintf(fmt, sizeof(fmt), "%%s/.debug-%%0%dd.log", (int) ceil(log10(cfg.concurrency+1)));
+        trace_header_t hdr;
+        struct timespec ts;
+        char *path;
+
         if(*cfg.debug == '\0') cfg.debug = ".";
+        asprintf(&path, "%s/.debug.trace", cfg.debug);
+        cfg.trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(cfg.trace_fd < 0) {
+            fprintf(stderr, "open %s failure: %s\n", path, strerror(errno));
+            cfg.debug = NULL;
+        } else {
+            memset(&hdr, 0, sizeof(hdr));
+            memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+            clock_gettime(CLOCK_REALTIME, &ts);
+            hdr.realtime = ts.tv_sec * 1000000000L + ts.tv_nsec;
+            hdr.monotonic = nanotime();
+            hdr.concurrency = cfg.concurrency;
+            write_all(cfg.trace_fd, (const char*) &hdr, sizeof(hdr));
+        }
+        free(path);
     }
 
-    if(cfg.requests > 0 && cfg.concurrency > cfg.requests) cfg.concurrency = cfg.requests;
+    if(cfg.request_log) {
+        // workers append whole buffers of records, O_APPEND keeps them from overwriting each other
+        cfg.request_log_fd = open(cfg.request_log, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if(cfg.request_log_fd < 0) {
+            fprintf(stderr, "open %s failure: %s\n", cfg.request_log, strerror(errno));
+            cfg.request_log = NULL;
+        } else {
+            write_all(cfg.request_log_fd, REQUEST_LOG_MAGIC, strlen(REQUEST_LOG_MAGIC));
+        }
+    }
+
+    // scheduled and profiled runs start with every idx idle, closed-loop runs with all of them in flight
+    idle_start = (cfg.rate > 0 || cfg.replay_speed > 0 || cfg.stagec || cfg.capacity);
+
+    if(cfg.random) alias_build(&cfg);
+    if(cfg.body == BODY_CHECKSUM) cfg.checksums = (unsigned long int*) calloc(cfg.corpus ? cfg.corpusc : cfg.urlc, sizeof(unsigned long int));
+    cfg.tmpl = make_template(&cfg);
+    if(cfg.share) cfg.sh = make_share();
+
+    // each worker owns a slice of idxs
+    for(c=0; c<cfg.threads; c++) {
+        worker_t *w = &workers[c];
+
+        w->id = c;
+        w->cfg = &cfg;
+        w->multi = curl_multi_init();
+        w->tmpl = curl_easy_duphandle(cfg.tmpl);
+
+        if(cfg.http_version) curl_multi_setopt(w->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_easy_setopt(w->tmpl, CURLOPT_CLOSESOCKETDATA, w);
+        w->port_conns = (int*) malloc(CONN_PORTS * sizeof(int));
+        memset(w->port_conns, 0xff, CONN_PORTS * sizeof(int));
+        if(cfg.debug) w->trace.buf = (char*) malloc(TRACE_RING_SIZE);
+        if(cfg.request_log) w->request_buf = (char*) malloc(BODY_BUFSIZE);
+        if(cfg.url_stats) w->url_stats = (url_stats_t**) calloc(cfg.urlc, sizeof(url_stats_t*));
+
+        if(cfg.body == BODY_STDERR) {
+            w->body_fd = STDERR_FILENO;
+            w->body_buf = (char*) malloc(BODY_BUFSIZE);
+        } else if(cfg.body == BODY_SAMPLE) {
+            // one file per worker, so that bodies are not interleaved
+            char *path = cfg.sample_file;
+
+            if(cfg.threads > 1) asprintf(&path, "%s.%d", cfg.sample_file, c);
+            w->body_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if(w->body_fd < 0) {
+                fprintf(stderr, "open %s failure: %s\n", path, strerror(errno));
+                w->body_fd = open("/dev/null", O_WRONLY);
+            }
+            w->body_buf = (char*) malloc(BODY_BUFSIZE);
+            if(path != cfg.sample_file) free(path);
+        }
+        if(cfg.max_host_connections) curl_multi_setopt(w->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) cfg.max_host_connections);
+        if(cfg.max_streams) curl_multi_setopt(w->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long) cfg.max_streams);
+        w->idxs = idxs + (long int) cfg.concurrency * c / cfg.threads;
+        w->idxc = (long int) cfg.concurrency * (c + 1) / cfg.threads - (w->idxs - idxs);
+        w->stats.concurrency = idle_start ? 0 : w->idxc;
+
+        // keep a connection for every idx, also for idle ones that are not added to the multi handle
+        curl_multi_setopt(w->multi, CURLMOPT_MAXCONNECTS, (long) w->idxc);
+
+        if(cfg.epoll) {
+            struct epoll_event ev;
+
+            w->epfd = epoll_create1(EPOLL_CLOEXEC);
+            w->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = w->wakefd;
+            epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->wakefd, &ev);
+
+            curl_multi_setopt(w->multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+            curl_multi_setopt(w->multi, CURLMOPT_SOCKETDATA, w);
+            curl_multi_setopt(w->multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+            curl_multi_setopt(w->multi, CURLMOPT_TIMERDATA, w);
+        }
+
+        for(i=0; i<w->idxc; i++) w->idxs[i].worker = w;
+    }
 
     for(c=0; c<cfg.concurrency; c++) {
-        if(cfg.debug) asprintf(&idxs[c].logfile, fmt, cfg.debug, c+1);
+        idxs[c].id = c + 1;
+        idxs[c].sock = CURL_SOCKET_BAD;
         if(cfg.verbose) idxs[c].logfp = stderr;
+    }
+
+    // render buffers of the templates, and -H lists whose templated entries point into them
+    if(cfg.templated) {
+        tmpl_bufs = (char*) malloc(cfg.tmpl_size * cfg.concurrency);
+        if(cfg.header_templated) tmpl_headers = (struct curl_slist*) malloc(sizeof(struct curl_slist) * cfg.headerc * cfg.concurrency);
+        for(c=0; c<cfg.concurrency; c++) {
+            idxs[c].tmpl_buf = tmpl_bufs + cfg.tmpl_size * c;
+            if(!tmpl_headers) continue;
+            idxs[c].headers = tmpl_headers + cfg.headerc * c;
+            for(i=0; i<cfg.headerc; i++) {
+                idxs[c].headers[i].data = cfg.header_tmpls[i] ? idxs[c].tmpl_buf + cfg.header_offs[i] : cfg.headers[i];
+                idxs[c].headers[i].next = i + 1 < cfg.headerc ? &idxs[c].headers[i + 1] : NULL;
+            }
+        }
+    }
+
+    // --expect: carries of body= over chunk boundaries, the start of the body for regex= and json=
+    if(cfg.expectc) {
+        expect_bufs = (char*) malloc(((EXPECT_NEEDLE - 1) * cfg.expectc + (cfg.expect_buffer ? BODY_BUFSIZE + 1 : 0)) * cfg.concurrency);
+        for(c=0; c<cfg.concurrency; c++) {
+            idxs[c].expect_carry = expect_bufs + ((EXPECT_NEEDLE - 1) * cfg.expectc + (cfg.expect_buffer ? BODY_BUFSIZE + 1 : 0)) * c;
+            idxs[c].expect_body = idxs[c].expect_carry + (EXPECT_NEEDLE - 1) * cfg.expectc;
+        }
+    }
+
+    // every idx may hold a connection, raise the open files limit as far as allowed
+    {
+        struct rlimit rl;
 
-        curl_multi_add_handle(multi, make_curl(&cfg, &idxs[c]));
+        if(!getrlimit(RLIMIT_NOFILE, &rl)) {
+            if(rl.rlim_cur < rl.rlim_max) {
+                rl.rlim_cur = rl.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &rl);
+            }
+            if(rl.rlim_cur < cfg.concurrency + 64 && !cfg.coordinator) fprintf(stderr, "open files limit %ld is too low for concurrency %d\n", (long int) rl.rlim_cur, cfg.concurrency);
+        }
     }
 
     signal(SIGPIPE, SIG_IGN);
     signal(SIGHUP, SIG_IGN);
-    signal(SIGINT, sig_handler);
-    signal(SIGTERM, sig_handler);
-    signal(SIGQUIT, sig_handler);
-    signal(SIGUSR1, sig_handler);
-    signal(SIGUSR2, sig_handler);
 
-    {
-        struct itimerval itv;
+    // signals are handled synchronously by sigwait() in main thread only
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGTERM);
+    sigaddset(&sigset, SIGQUIT);
+    sigaddset(&sigset, SIGUSR1);
+    sigaddset(&sigset, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &sigset, NULL);
 
-        itv.it_interval.tv_sec = itv.it_value.tv_sec = 1;
-        itv.it_interval.tv_usec = itv.it_value.tv_usec = 0;
+    main_thread = pthread_self();
+    if(cfg.agent && agent_ready(cfg.agent_fd)) goto fail;
+    if(cfg.capacity) capacity_target = 1;
+    begin_reqs = idle_start ? 0 : cfg.concurrency;
+    measure_start(&cfg);
+    workers_running = cfg.coordinator ? cfg.agents : cfg.threads;
+    if(cfg.coordinator) coordinator_start();
 
-        setitimer(ITIMER_REAL, &itv, NULL);
-        signal(SIGALRM, sig_handler);
+    // drained from before the first request, --preconnect fills the rings too
+    if(cfg.debug) {
+        trace_running = true;
+        pthread_create(&trace_thread, NULL, trace_run, workers);
+    }
+    if(cfg.preconnect && cfg.threads) pthread_barrier_init(&preconnect_barrier, NULL, cfg.threads + 1);
+    for(c=0; c<cfg.threads; c++) {
+        pthread_create(&workers[c].tid, NULL, worker_run, &workers[c]);
+    }
+    if(cfg.preconnect && cfg.threads) {
+        pthread_barrier_wait(&preconnect_barrier);
+        measure_start(&cfg);
+        pthread_barrier_wait(&preconnect_barrier);
+        pthread_barrier_destroy(&preconnect_barrier);
     }
 
     {
-        time_t timelimit = time(NULL) + cfg.timelimit;
-        volatile int still_running, msgs;
-        CURL *curl;
-        CURLMcode mc;
-        struct CURLMsg *m;
-        idx_t *idx;
-        int code;
-        int concurrency = cfg.concurrency, keepalives = 0;
-        long int code0xx = 0, code1xx = 0, code2xx = 0, code3xx = 0, code4xx = 0, code5xx = 0, codex = 0;
-        long int begin_reqs = cfg.concurrency, end_reqs = 0, prev_reqs = 0;
-        long int prev_req_bytes = 0, prev_res_bytes = 0, prev_bug_bytes = 0;
-        int times = 0;
-        double req_times[10000];
-        const long int req_timec = sizeof(req_times) / sizeof(req_times[0]);
-        char bufs[3][32];
-
-        memset(req_times, 0, sizeof(req_times));
+        int sig, running, times = 0;
+        static stats_t total, prev, warm, prev_warm;
+        static hist_t interval;
+        static capacity_t capacity;
+        long int ivals[HIST_STATS], tvals[HIST_STATS], pvals[PHASES][HIST_STATS], cvals[2][HIST_STATS];
+        char bufs[4][32];
+        double begin = microtime(), last = begin, now, seconds, next = begin + cfg.interval, wait;
+        struct timespec timeout;
+        health_t health;
+        health_mark_t mark, start;
+        int saturated = 0;
 
+        if(cfg.output == OUTPUT_CSV) report_header(&cfg);
+        capacity.level = 1;
+        capacity.since = begin;
+        memset(&mark, 0, sizeof(mark));
+        health_sample(&cfg, &health, &mark, 0, &total, &prev);
+        start = mark;
+
+        // a report is due every --interval on CLOCK_MONOTONIC, SIGALRM means the workers are done
         do {
-            still_running = 0;
-            mc = curl_multi_perform(multi, (int*) &still_running);
+            wait = next - microtime();
+            if(wait < 0) wait = 0;
+            timeout.tv_sec = (time_t) wait;
+            timeout.tv_nsec = (long int) ((wait - timeout.tv_sec) * 1000000000);
+            sig = sigtimedwait(&sigset, NULL, &timeout);
+            if(sig < 0 && errno != EAGAIN) continue;
+            running = __atomic_load_n(&workers_running, __ATOMIC_ACQUIRE);
 
-            if(mc) {
-                fprintf(stderr, "curl_multi_perform error: %s\n", curl_multi_strerror(mc));
-                break;
-            }
-
-            do {
-                msgs = 0;
-                m = curl_multi_info_read(multi, (int*) &msgs);
-                if(m && (m->msg && CURLMSG_DONE)) {
-                    curl = m->easy_handle;
-
-                    code = 0;
-                    idx = NULL;
-                    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
-                    curl_easy_getinfo(curl, CURLINFO_PRIVATE, &idx);
-
-	                curl_multi_remove_handle(multi, curl);
-					if(idx->keepalive) {
-						if(idx->curl != curl) {
-							keepalives ++;
-							if(idx->curl) {
-								curl_easy_cleanup(idx->curl);
-								idx->curl = NULL;
-							}
-						}
-						curl_easy_reset(curl);
-						idx->curl = curl;
-						curl = NULL;
-					} else {
-						if(idx->curl == curl) {
-							keepalives --;
-						}
-		                curl_easy_cleanup(curl);
-						idx->curl = NULL;
-		                curl = NULL;
-	                }
-
-                    if(code < 100) {
-                        code0xx ++;
-                    } else if(code < 200) {
-                        code1xx ++;
-                    } else if(code < 300) {
-                        code2xx ++;
-                    } else if(code < 400) {
-                        code3xx ++;
-                    } else if(code < 500) {
-                        code4xx ++;
-                    } else if(code < 600) {
-                        code5xx ++;
-                    } else {
-                        codex ++;
-                    }
+            if(sig > 0 && sig != SIGALRM) {
+                is_running = false;
+                // printf("SIG: %d\n", sig);
+                for(c=0; c<cfg.threads; c++) worker_wakeup(&workers[c]);
+                if(cfg.coordinator) coordinator_stop();
+                continue;
+            }
+
+            memset(&total, 0, sizeof(total));
+            for(c=0; c<cfg.threads; c++) stats_merge(&total, &workers[c].stats, cfg.phases);
+            if(cfg.coordinator) coordinator_merge(&total, cfg.phases);
+            memset(&warm, 0, sizeof(warm));
+            for(c=0; c<cfg.threads; c++) stats_merge(&warm, &workers[c].warmup, false);
+            now = microtime();
+            times ++;
+            while(next <= now) next += cfg.interval;
+            health_sample(&cfg, &health, &mark, now - last, &total, &prev);
+            if(health.saturated) {
+                saturated ++;
+                health_warn(&health);
+            }
+
+            if(cfg.agent) {
+                msg_send(cfg.agent_fd, running ? MSG_STATS : MSG_DONE, &total, sizeof(total));
+            } else if(cfg.output) {
+                report_record(&cfg, false, walltime(), now - begin, now - last, &total, &prev, &health, &warm, &prev_warm);
+            } else {
+                if(!is_running && isatty(1)) printf("\033[2K\r");
 
-                    req_times[end_reqs % req_timec] = microtime() - idx->time;
-                    end_reqs ++;
-
-                    if(idx->logfp) fprintf(idx->logfp, "%s * END %dst REQUEST - %lf\n", nowtime(), idx->reqs,  microtime() - idx->time);
-
-                    if(idx->headers) {
-                    	curl_slist_free_all(idx->headers);
-                    	idx->headers = NULL;
-                	}
-                    if(idx->form) {
-                    	curl_formfree(idx->form);
-                    	idx->form = NULL;
-                	}
-                    if(idx->fp_upload) {
-                    	fclose(idx->fp_upload);
-                    	idx->fp_upload = NULL;
-                	}
-
-                    if(is_running && (cfg.requests <= 0 || begin_reqs < cfg.requests) && (cfg.timelimit <= 0 || timelimit >= time(NULL))) {
-                        begin_reqs ++;
-                        curl_multi_add_handle(multi, make_curl(&cfg, idx));
-                    } else {
-                        concurrency --;
-                        if(idx->curl) {
-				            curl_easy_cleanup(idx->curl);
-				            idx->curl = NULL;
-				            idx->keepalive = false;
-				            keepalives --;
-                        }
+                hist_delta(&interval, &total.latency, &prev.latency);
+                hist_stats(&interval, ivals);
+                hist_stats(&total.latency, tvals);
+
+                printf("times: %d, concurrency: %d, keepalives: %d, 0xx: %ld, 1xx: %ld, 2xx: %ld, 3xx: %ld, 4xx: %ld, 5xx: %ld, xxx: %ld, reqs: %.0lf/s, bytes: %s/%s/%s, min/avg/p50/p90/p99/p99.9/max: %.1lf/%.1lf/%.1lf/%.1lf/%.1lf/%.1lf/%.1lfms, total: %.1lf/%.1lf/%.1lf/%.1lf/%.1lf/%.1lf/%.1lfms", times, total.concurrency, total.keepalives, total.code0xx, total.code1xx, total.code2xx, total.code3xx, total.code4xx, total.code5xx, total.codex, now > last ? (total.end_reqs - prev.end_reqs) / (now - last) : 0, fsize(total.req_bytes - prev.req_bytes, bufs[0]), fsize(total.res_bytes - prev.res_bytes, bufs[1]), fsize(total.bug_bytes - prev.bug_bytes, bufs[2]),
+                    ivals[HIST_MIN] / 1000.0, ivals[HIST_AVG] / 1000.0, ivals[HIST_P50] / 1000.0, ivals[HIST_P90] / 1000.0, ivals[HIST_P99] / 1000.0, ivals[HIST_P999] / 1000.0, ivals[HIST_MAX] / 1000.0,
+                    tvals[HIST_MIN] / 1000.0, tvals[HIST_AVG] / 1000.0, tvals[HIST_P50] / 1000.0, tvals[HIST_P90] / 1000.0, tvals[HIST_P99] / 1000.0, tvals[HIST_P999] / 1000.0, tvals[HIST_MAX] / 1000.0);
+
+                if(cfg.rate > 0 || cfg.replay_speed > 0) printf(", late: %ld, dropped: %ld", total.late - prev.late, total.dropped - prev.dropped);
+                if(cfg.tls) printf(", handshakes: %ld, resumed: %ld", total.handshakes - prev.handshakes, total.resumed - prev.resumed);
+                if(cfg.body == BODY_CHECKSUM) printf(", mismatches: %ld", total.mismatches - prev.mismatches);
+                if(cfg.expectc) printf(", failures: %ld", total.failures - prev.failures);
+                if(cfg.http_version) printf(", connections: %d, streams: %d", total.connections, total.streams);
+                printf(", new/reused: %ld/%ld", total.new_conns - prev.new_conns, total.reused_conns - prev.reused_conns);
+                if(!cfg.coordinator) printf(", cpu: %.0lf%%, cs: %ld, rss: %s", health.cpu * 100, health.ctxsw, fsize(health.rss, bufs[3]));
+                printf(", lag p99: %.1lfms, done/loop: %.1lf", health.lag_p99 / 1000.0, health.per_loop);
+                if(cfg.stagec || cfg.capacity) printf(", target: %d", total.target);
+                if(cfg.warmup > 0 || cfg.warmup_requests > 0 || cfg.preconnect) printf(", warmup: %ld", warm.end_reqs - prev_warm.end_reqs);
+                if(cfg.phases) {
+                    for(i=0; i<PHASES; i++) {
+                        hist_delta(&interval, &total.phases[i], &prev.phases[i]);
+                        hist_stats(&interval, pvals[i]);
                     }
+                    printf(", dns/connect/tls/ttfb/transfer p50: %.1lf/%.1lf/%.1lf/%.1lf/%.1lf, p99: %.1lf/%.1lf/%.1lf/%.1lf/%.1lfms",
+                        pvals[PHASE_DNS][HIST_P50] / 1000.0, pvals[PHASE_CONNECT][HIST_P50] / 1000.0, pvals[PHASE_TLS][HIST_P50] / 1000.0, pvals[PHASE_TTFB][HIST_P50] / 1000.0, pvals[PHASE_TRANSFER][HIST_P50] / 1000.0,
+                        pvals[PHASE_DNS][HIST_P99] / 1000.0, pvals[PHASE_CONNECT][HIST_P99] / 1000.0, pvals[PHASE_TLS][HIST_P99] / 1000.0, pvals[PHASE_TTFB][HIST_P99] / 1000.0, pvals[PHASE_TRANSFER][HIST_P99] / 1000.0);
                 }
-            } while(msgs);
+                printf("\n");
+            }
 
-            if(still_running) {
-                mc = curl_multi_poll(multi, NULL, 0, 1000, NULL);
-                if(mc) {
-                    fprintf(stderr, "curl_multi_poll error: %s\n", curl_multi_strerror(mc));
-                    break;
+            memcpy(&prev, &total, sizeof(total));
+            memcpy(&prev_warm, &warm, sizeof(warm));
+            last = now;
+
+            if(cfg.capacity && !capacity.done && is_running) {
+                capacity_step(&cfg, &capacity, &total, now);
+                if(capacity.done) {
+                    is_running = false;
+                    for(c=0; c<cfg.threads; c++) worker_wakeup(&workers[c]);
                 }
             }
+        } while(running);
 
-            if(is_timer || !concurrency) {
-                is_timer = false;
-                if(!is_running && isatty(1)) printf("\033[2K\r");
+        // rates of the summary are over the measured window only
+        seconds = microtime() - (measure_begin ? measure_begin / 1000000000.0 : begin);
+        memset(&prev, 0, sizeof(prev));
+        memset(&prev_warm, 0, sizeof(prev_warm));
+        health_sample(&cfg, &health, &start, microtime() - begin, &total, &prev);
+        health.saturated = health.saturated || saturated;
+        if(cfg.agent) {
+            // the coordinator reports
+        } else if(cfg.output) {
+            report_record(&cfg, true, walltime(), seconds, seconds, &total, &prev, &health, &warm, &prev_warm);
+            if(cfg.url_stats) url_report(&cfg, workers, seconds);
+        } else {
+            hist_stats(&total.latency, tvals);
+            printf("======== SUMMARY BEGIN ========\n");
+            printf("seconds: %.3lf\n", seconds);
+            printf("requests: %ld\n", total.end_reqs);
+            printf("reqs: %.1lf/s\n", seconds > 0 ? total.end_reqs / seconds : 0);
+            printf("codes: 0xx: %ld, 1xx: %ld, 2xx: %ld, 3xx: %ld, 4xx: %ld, 5xx: %ld, xxx: %ld\n", total.code0xx, total.code1xx, total.code2xx, total.code3xx, total.code4xx, total.code5xx, total.codex);
+            printf("bytes: %ld/%ld/%ld\n", total.req_bytes, total.res_bytes, total.bug_bytes);
+            hist_stats(&total.conn_reqs, cvals[0]);
+            hist_stats(&total.conn_life, cvals[1]);
+            printf("connections: new: %ld, reused: %ld, closed: %ld, requests/conn avg/p50/p99/max: %ld/%ld/%ld/%ld, lifetime avg/p50/p99/max: %.1lf/%.1lf/%.1lf/%.1lfms\n",
+                total.new_conns, total.reused_conns, total.conn_reqs.count, cvals[0][HIST_AVG], cvals[0][HIST_P50], cvals[0][HIST_P99], cvals[0][HIST_MAX],
+                cvals[1][HIST_AVG] / 1000.0, cvals[1][HIST_P50] / 1000.0, cvals[1][HIST_P99] / 1000.0, cvals[1][HIST_MAX] / 1000.0);
+            if(!cfg.coordinator) {
+                struct rusage ru;
+                double cpu;
 
-                double min = 0xffffffff, avg = 0, max = 0;
-                for(c=0; c<req_timec && c<end_reqs; c++) {
-                    if(req_times[c] < min) min = req_times[c];
-                    avg += req_times[c];
-                    if(req_times[c] > max) max = req_times[c];
-                }
-                if(c > 0) {
-                	avg /= c;
-                } else {
-                	min = 0;
-                }
+                getrusage(RUSAGE_SELF, &ru);
+                cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+                printf("cpu: user: %ld.%03lds, sys: %ld.%03lds, %.1lfus/req\n", (long int) ru.ru_utime.tv_sec, (long int) ru.ru_utime.tv_usec / 1000, (long int) ru.ru_stime.tv_sec, (long int) ru.ru_stime.tv_usec / 1000, total.end_reqs > 0 ? cpu * 1000000.0 / total.end_reqs : 0);
+                if(cfg.self_test) {
+                    double scpu = server_cpu();
 
-                printf("times: %d, concurrency: %d, keepalives: %d, 0xx: %ld, 1xx: %ld, 2xx: %ld, 3xx: %ld, 4xx: %ld, 5xx: %ld, xxx: %ld, reqs: %ld/s, bytes: %s/%s/%s, min: %.1lfms, avg: %.1lfms, max: %.1lfms\n", ++times, concurrency, keepalives, code0xx, code1xx, code2xx, code3xx, code4xx, code5xx, codex, end_reqs - prev_reqs, fsize(req_bytes - prev_req_bytes, bufs[0]), fsize(res_bytes - prev_res_bytes, bufs[1]), fsize(bug_bytes - prev_bug_bytes, bufs[2]), min * 1000.0f, avg * 1000.0f, max * 1000.0f);
+                    printf("self-test: client: %.1lfus/req, server: %.1lfus/req, memory: %.1lfKB/connection\n", total.end_reqs > 0 ? (cpu - scpu) * 1000000.0 / total.end_reqs : 0, total.end_reqs > 0 ? scpu * 1000000.0 / total.end_reqs : 0, conn_memory(&cfg) / 1024);
+                }
+            }
+            printf("client: ");
+            if(!cfg.coordinator) printf("cpu: %.0lf%%, context switches: %ld, rss: %s, ", health.cpu * 100, health.ctxsw, fsize(health.rss, bufs[3]));
+            printf("loop lag p99: %.3lfms, completions/loop: %.1lf\n", health.lag_p99 / 1000.0, health.per_loop);
+            if(saturated) printf("saturated: %d of %d intervals, latencies are not trustworthy\n", saturated, times);
+            if(cfg.warmup > 0 || cfg.warmup_requests > 0 || cfg.preconnect) {
+                hist_stats(&warm.latency, ivals);
+                printf("warmup: requests: %ld, latency p50/p99/max: %.3lf/%.3lf/%.3lfms, counted apart\n", warm.end_reqs, ivals[HIST_P50] / 1000.0, ivals[HIST_P99] / 1000.0, ivals[HIST_MAX] / 1000.0);
+            }
+            if(cfg.rate > 0 || cfg.replay_speed > 0) printf("late: %ld, dropped: %ld\n", total.late, total.dropped);
+            if(cfg.tls) printf("handshakes: %ld, resumed: %ld\n", total.handshakes, total.resumed);
+            if(cfg.body == BODY_CHECKSUM) printf("mismatches: %ld\n", total.mismatches);
+            if(cfg.expectc) {
+                printf("failures: %ld (%.2lf%%)\n", total.failures, total.end_reqs > 0 ? total.failures * 100.0 / total.end_reqs : 0);
+                for(i=0; i<cfg.expectc; i++) printf("  %s: %ld failed\n", cfg.expects[i].arg, total.expect_fails[i]);
+            }
+            if(cfg.debug) {
+                long int dropped = 0;
 
-                prev_reqs = end_reqs;
-                prev_req_bytes = req_bytes;
-                prev_res_bytes = res_bytes;
-                prev_bug_bytes = bug_bytes;
+                for(c=0; c<cfg.threads; c++) dropped += STAT_GET(workers[c].trace.dropped);
+                printf("trace: %s/.debug.trace, dropped: %ld\n", cfg.debug, dropped);
+            }
+            printf("latency: min: %.3lfms, avg: %.3lfms, p50: %.3lfms, p90: %.3lfms, p99: %.3lfms, p99.9: %.3lfms, max: %.3lfms\n", tvals[HIST_MIN] / 1000.0, tvals[HIST_AVG] / 1000.0, tvals[HIST_P50] / 1000.0, tvals[HIST_P90] / 1000.0, tvals[HIST_P99] / 1000.0, tvals[HIST_P999] / 1000.0, tvals[HIST_MAX] / 1000.0);
+            if(cfg.phases) {
+                for(i=0; i<PHASES; i++) {
+                    hist_stats(&total.phases[i], pvals[i]);
+                    printf("%s: min: %.3lfms, avg: %.3lfms, p50: %.3lfms, p90: %.3lfms, p99: %.3lfms, p99.9: %.3lfms, max: %.3lfms\n", phase_names[i], pvals[i][HIST_MIN] / 1000.0, pvals[i][HIST_AVG] / 1000.0, pvals[i][HIST_P50] / 1000.0, pvals[i][HIST_P90] / 1000.0, pvals[i][HIST_P99] / 1000.0, pvals[i][HIST_P999] / 1000.0, pvals[i][HIST_MAX] / 1000.0);
+                }
             }
-        } while(concurrency);
+            if(cfg.url_stats) url_report(&cfg, workers, seconds);
+            printf("========= SUMMARY END =========\n");
+        }
+        if(cfg.capacity) capacity_report(&cfg, &capacity);
 
         // printf("begin_reqs: %d, end_reqs: %d\n", begin_reqs, end_reqs); // begin_reqs equals end_reqs
     }
 
-    curl_multi_cleanup(multi);
+    for(c=0; c<cfg.threads; c++) {
+        pthread_join(workers[c].tid, NULL);
+        curl_multi_cleanup(workers[c].multi);
+        curl_easy_cleanup(workers[c].tmpl);
+        free(workers[c].conns);
+        free(workers[c].port_conns);
+        if(cfg.epoll) {
+            close(workers[c].epfd);
+            close(workers[c].wakefd);
+        }
+        if(workers[c].url_stats) {
+            for(i=0; i<cfg.urlc; i++) free(workers[c].url_stats[i]);
+            free(workers[c].url_stats);
+        }
+    }
+    if(cfg.debug) {
+        trace_running = false;
+        pthread_join(trace_thread, NULL);
+        close(cfg.trace_fd);
+        for(c=0; c<cfg.threads; c++) free(workers[c].trace.buf);
+    }
+    if(cfg.request_log) close(cfg.request_log_fd);
+    if(cfg.coordinator) coordinator_cleanup();
+    if(cfg.self_test) server_stop();
+    if(cfg.agent) close(cfg.agent_fd);
+    curl_easy_cleanup(cfg.tmpl);
+    if(cfg.sh) curl_share_cleanup(cfg.sh);
+    if(cfg.header_list) curl_slist_free_all(cfg.header_list);
     curl_global_cleanup();
 
     for(c=0; c<cfg.concurrency; c++) {
-        if(idxs[c].logfile) {
-            // unlink(idxs[c].logfile);
-            free(idxs[c].logfile);
-        }
-        if(idxs[c].logfp) {
-            fclose(idxs[c].logfp);
-        }
+        free(idxs[c].forms);
+        free(idxs[c].sample_buf);
     }
     free(idxs);
+    free(workers);
+    free(tmpl_bufs);
+    free(tmpl_headers);
+    free(expect_bufs);
+    for(i=0; i<cfg.expectc; i++) {
+        if(cfg.expects[i].type == EXPECT_REGEX) regfree(&cfg.expects[i].re);
+    }
 
     if(cfg.urlw) {
         free(cfg.urlw);
     }
+    free(cfg.alias_prob);
+    free(cfg.alias);
+    if(cfg.checksums) {
+        free(cfg.checksums);
+    }
+    goto end;
 
+    // a misconfigured run exits with failure, for scripts and CI
+fail:
+    ret = EXIT_FAILURE;
 end:
     for(c=0; c<cfg.formc; c++) {
         free(cfg.forms[c].name);
         free(cfg.forms[c].value);
     }
+    if(cfg.url_buf) {
+        free(cfg.url_buf);
+        free(cfg.urls);
+    }
+    if(cfg.corpus_map) munmap(cfg.corpus_map, cfg.corpus_size);
+    unmap_file(cfg.upload_map, cfg.upload_size);
+    for(c=0; c<cfg.formc; c++) unmap_file(cfg.forms[c].map, cfg.forms[c].size);
+    tmpl_cleanup(&cfg);
+    free(cfg.corpus);
+    free(cfg.corpus_headers);
 
-    return 0;
+    return ret;
 }